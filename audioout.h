@@ -2,37 +2,170 @@
 #define AUDIO_OUT_H_
 
 #include "audiosink.h"
-#include "resample/resampler.h"
-#include "resample/resamplerinfo.h"
+#include "resamplechain.h"
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
 
 class AudioOut {
 public:
 	struct Status {
 		long rate;
 		bool low;
+		usec_t blocked;
 
-		Status(long rate, bool low) : rate(rate), low(low) {}
+		Status(long rate, bool low, usec_t blocked = 0)
+		: rate(rate), low(low), blocked(blocked)
+		{
+		}
 	};
 
-	AudioOut(long sampleRate, int latency, int periods,
-	         ResamplerInfo const &resamplerInfo, std::size_t maxInSamplesPerWrite)
-	: resampler_(resamplerInfo.create(2097152, sampleRate, maxInSamplesPerWrite))
-	, resampleBuf_(resampler_->maxOut(maxInSamplesPerWrite) * 2)
-	, sink_(sampleRate, latency, periods)
+	// Opens the audio device. Call setResampler before writing.
+	// With dynamicRate, writes never block and the caller paces itself.
+	// Instead of waiting for the device, the resampler's output rate follows
+	// the device's estimated rate, nudged by up to 0.5% to keep the buffer
+	// half full.
+	AudioOut(long sampleRate, int latency, int periods, bool adaptiveLatency,
+	         bool dynamicRate)
+	: sink_(sampleRate, latency, periods, adaptiveLatency)
+	, dynamicRate_(dynamicRate)
+	, lastStatus_(0, 0, 0)
+	, tap_(0)
+	, tapContext_(0)
 	{
 	}
 
-	Status write(Uint32 const *data, std::size_t samples) {
-		long const outsamples = resampler_->resample(
-			resampleBuf_, reinterpret_cast<Sint16 const *>(data), samples);
-		AudioSink::Status const &stat = sink_.write(resampleBuf_, outsamples);
+	// Resamples to sampleRate() from here on, so the resampler can be
+	// picked for the rate the device granted. With predecimate, the core's
+	// output is decimated by Decimator::FACTOR before it reaches the
+	// resampler.
+	void setResampler(bool predecimate, ResamplerInfo const &resamplerInfo,
+	                  std::size_t maxInSamplesPerWrite)
+	{
+		chain_.reset(new ResampleChain(sink_.sampleRate(), predecimate, resamplerInfo,
+		                               maxInSamplesPerWrite));
+		// Room for a rate up to 1% above nominal, see adjustRate
+		resampleBuf_.reset((chain_->maxOut(maxInSamplesPerWrite) * 101 / 100 + 1) * 2);
+	}
+
+	// The rate granted by the audio device, which may differ from the one
+	// asked for
+	long sampleRate() const { return sink_.sampleRate(); }
+	void start() { sink_.start(); }
+
+	// Everything resampled by write, including audio dropped for lack of
+	// room, is passed on to tap as stereo samples at the output rate
+	typedef void (*Tap)(void *context, Sint16 const *samples, std::size_t count);
+	void setTap(Tap tap, void *context) { tap_ = tap; tapContext_ = context; }
+
+	// Resamples straight into the audio ring. Only output that would
+	// straddle the end of the ring, or that does not fit in it at all, goes
+	// through an intermediate buffer.
+	Status write(Uint32 const *data, std::size_t samples, bool block = true) {
+		if (dynamicRate_)
+			adjustRate();
+
+		Sint16 const *in = reinterpret_cast<Sint16 const *>(data);
+		AudioSink::Status stat = sink_.beginWrite();
+		long outsamples = 0;
+		while (samples) {
+			AudioSink::Spans const room =
+				sink_.reserve(chain_->maxOut(samples), block && !dynamicRate_, stat);
+			std::size_t n = fitting(samples, room.firstSize);
+			std::size_t out;
+			if (n) {
+				out = chain_->resample(room.first, in, n);
+				sink_.commit(out);
+				tap(room.first, out);
+			} else {
+				// A small piece across the end of the ring, or all the rest
+				// if even that does not fit
+				n = fitting(samples, std::min(room.firstSize + bounce_samples,
+				                              room.firstSize + room.secondSize));
+				if (!n)
+					n = samples;
+
+				out = chain_->resample(resampleBuf_, in, n);
+				sink_.commit(put(room, resampleBuf_, out));
+				tap(resampleBuf_, out);
+			}
+
+			in += n * 2;
+			samples -= n;
+			outsamples += out;
+		}
+
+		lastStatus_ = stat;
 		bool low = stat.fromUnderrun + outsamples < (stat.fromOverflow - outsamples) * 2;
-		return Status(stat.rate, low);
+		return Status(stat.rate, low, stat.blocked);
 	}
 
 private:
-	scoped_ptr<Resampler> const resampler_;
-	Array<Sint16> const resampleBuf_;
 	AudioSink sink_;
+	scoped_ptr<ResampleChain> chain_;
+	Array<Sint16> resampleBuf_;
+	bool const dynamicRate_;
+	AudioSink::Status lastStatus_;
+	Tap tap_;
+	void *tapContext_;
+
+	enum { bounce_samples = 64 };
+
+	// The most of the samples whose output fits in room
+	std::size_t fitting(std::size_t samples, std::size_t room) const {
+		if (chain_->maxOut(samples) <= room)
+			return samples;
+
+		std::size_t lo = 0, hi = samples;
+		while (hi - lo > 1) {
+			std::size_t const mid = lo + (hi - lo) / 2;
+			if (chain_->maxOut(mid) <= room)
+				lo = mid;
+			else
+				hi = mid;
+		}
+
+		return lo;
+	}
+
+	static std::size_t put(AudioSink::Spans const &room, Sint16 const *samples, std::size_t n) {
+		std::size_t const first = std::min(n, room.firstSize);
+		std::size_t const second = std::min(n - first, room.secondSize);
+		std::memcpy(room.first, samples, first * 2 * sizeof *samples);
+		std::memcpy(room.second, samples + first * 2, second * 2 * sizeof *samples);
+		return first + second;
+	}
+
+	void tap(Sint16 const *samples, std::size_t n) const {
+		if (tap_)
+			tap_(tapContext_, samples, n);
+	}
+
+	void adjustRate() {
+		double const max_rate_deviation = 0.005;
+		long const buffered = lastStatus_.fromUnderrun;
+		long const size = buffered + lastStatus_.fromOverflow;
+		if (size <= 0)
+			return;
+
+		// From -1 when empty to 1 when full
+		double const fill = (2.0 * buffered - size) / size;
+		// The measured rate is noisy and can be way off early on. Limiting it
+		// as well keeps the output within 1% of the nominal rate, which the
+		// bounce buffer leaves room for.
+		long const nominal = sink_.sampleRate();
+		long const estRate = lastStatus_.rate > 0
+			? std::max(static_cast<long>(nominal * (1 - max_rate_deviation)),
+			           std::min(lastStatus_.rate,
+			                    static_cast<long>(nominal * (1 + max_rate_deviation))))
+			: nominal;
+		long const rate = static_cast<long>(estRate * (1 - max_rate_deviation * fill) + 0.5);
+
+		// Small steps are inaudible either way, and not worth recomputing
+		// the resampler for
+		Resampler &resampler = chain_->resampler();
+		if (std::labs(rate - resampler.outRate()) >= 2)
+			resampler.adjustRate(resampler.inRate(), rate);
+	}
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,85 @@
+#include "audioring.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+// Maps bytes of shared memory at two adjacent addresses, returning the first
+// or 0 on failure
+static void * mapMirrored(std::size_t const bytes) {
+	char name[64];
+	std::sprintf(name, "/gambatte-sdl2-audio-%ld", static_cast<long>(getpid()));
+	int const fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+	if (fd < 0)
+		return 0;
+
+	// Only the mappings keep the memory around
+	shm_unlink(name);
+
+	void *base = MAP_FAILED;
+	if (ftruncate(fd, bytes) == 0) {
+		// Reserve the whole range first, so that nothing else can end up
+		// between the two halves
+		base = mmap(0, bytes * 2, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	}
+
+	if (base != MAP_FAILED) {
+		char *const p = static_cast<char *>(base);
+		if (mmap(p, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+				|| mmap(p + bytes, bytes, PROT_READ | PROT_WRITE,
+				        MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED) {
+			munmap(base, bytes * 2);
+			base = MAP_FAILED;
+		}
+	}
+
+	close(fd);
+	return base != MAP_FAILED ? base : 0;
+}
+
+} // anon ns
+
+AudioRing::AudioRing(std::size_t const capacity)
+: capacity_(capacity)
+, mirror_(0)
+, mirrorBytes_(0)
+, buf_(0)
+, size_(0)
+, pos_(0)
+{
+	long const page = sysconf(_SC_PAGESIZE);
+	if (page > 0) {
+		mirrorBytes_ = (capacity * sizeof *buf_ + page - 1) / page * page;
+		mirror_ = static_cast<Uint32 *>(mapMirrored(mirrorBytes_));
+	}
+
+	if (mirror_) {
+		buf_ = mirror_;
+		size_ = mirrorBytes_ / sizeof *buf_;
+	} else {
+		fallback_.reset(capacity * 2);
+		buf_ = fallback_;
+		size_ = fallback_.size();
+	}
+
+	std::memset(buf_, 0, size_ * sizeof *buf_);
+}
+
+AudioRing::~AudioRing() {
+	if (mirror_)
+		munmap(mirror_, mirrorBytes_ * 2);
+}
+
+void AudioRing::consume(std::size_t const num, std::size_t const remaining) {
+	pos_ += num;
+	if (mirror_) {
+		if (pos_ >= size_)
+			pos_ -= size_;
+	} else if (pos_ + capacity_ > size_) {
+		std::memmove(buf_, buf_ + pos_, remaining * sizeof *buf_);
+		pos_ = 0;
+	}
+}
@@ -0,0 +1,41 @@
+#ifndef AUDIO_RING_H_
+#define AUDIO_RING_H_
+
+#include <common/array.h>
+#include <common/uncopyable.h>
+#include <SDL.h>
+#include <cstddef>
+
+// Buffer the core's audio output is run into. The core needs contiguous room
+// for a frame's worth of samples, and whatever follows the end of a frame is
+// kept for the next one. Rather than moving those samples to the start of a
+// buffer every frame, the front of the buffer moves on. The ring's memory is
+// mapped twice in a row, so the room after the front is contiguous wherever
+// it starts and nothing is ever moved. If the mapping cannot be set up, a
+// buffer twice as large as needed is used instead and the leftover samples
+// are moved to the start only when the front gets too close to its end.
+class AudioRing : Uncopyable {
+public:
+	// At least capacity samples of room after front() at all times
+	explicit AudioRing(std::size_t capacity);
+	~AudioRing();
+
+	std::size_t capacity() const { return capacity_; }
+	bool mirrored() const { return mirror_; }
+	Uint32 * front() const { return buf_ + pos_; }
+
+	// Drops num samples from the front, remaining of which are left
+	// buffered after them
+	void consume(std::size_t num, std::size_t remaining);
+
+private:
+	std::size_t const capacity_;
+	Uint32 *mirror_;
+	std::size_t mirrorBytes_;
+	Array<Uint32> fallback_;
+	Uint32 *buf_;
+	std::size_t size_;
+	std::size_t pos_;
+};
+
+#endif
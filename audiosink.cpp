@@ -19,6 +19,7 @@
 #include "audiosink.h"
 #include "SDL_log.h"
 #include <SDL_thread.h>
+#include <algorithm>
 #include <cstdio>
 
 namespace {
@@ -38,80 +39,160 @@ static unsigned long nearestPowerOf2(unsigned long const in) {
 	return out;
 }
 
-static int openAudio(long srate, std::size_t samples,
-                     void (*callback)(void *userdata, Uint8 *stream, int len),
-                     void *userdata)
+// Audio buffered ahead of the device is adapted over windows of this
+// length: it shrinks after a window without underruns
+usec_t const adapt_window = 2000000;
+// After an underrun, it is held for this long before shrinking again
+usec_t const adapt_hold = 10000000;
+
+static SDL_AudioDeviceID openAudio(long srate, std::size_t samples,
+                                   void (*callback)(void *userdata, Uint8 *stream, int len),
+                                   void *userdata, SDL_AudioSpec &obtained)
 {
 	SDL_Log("Opening audio");
 	SDL_AudioSpec spec;
+	SDL_zero(spec);
 	spec.freq = srate;
 	spec.format = AUDIO_S16SYS;
 	spec.channels = 2;
 	spec.samples = samples;
 	spec.callback = callback;
 	spec.userdata = userdata;
-	if (SDL_OpenAudio(&spec, 0) < 0) {
+
+	SDL_AudioDeviceID const dev = SDL_OpenAudioDevice(0, 0, &spec, &obtained,
+		SDL_AUDIO_ALLOW_FREQUENCY_CHANGE | SDL_AUDIO_ALLOW_SAMPLES_CHANGE);
+	if (!dev) {
 		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not open audio: %s\n", SDL_GetError());
-		return -1;
+		return 0;
 	}
 
-	return 0;
+	SDL_Log("Audio device runs at %d Hz with a buffer of %d samples",
+	        obtained.freq, obtained.samples);
+	return dev;
 }
 
-class LockGuard {
-public:
-	explicit LockGuard(SDL_mutex *m) : m_(m) { SDL_mutexP(m); }
-private:
-	struct LockDeleter { static void del(SDL_mutex *m) { SDL_mutexV(m); } };
-	scoped_ptr<SDL_mutex, LockDeleter> const m_;
-};
-
 } // anon ns
 
-struct AudioSink::SdlDeleter {
-	static void del(SDL_mutex *m) { SDL_DestroyMutex(m); }
-	static void del(SDL_cond *c) { SDL_DestroyCond(c); }
-};
-
-AudioSink::AudioSink(long const srate, int const latency, int const periods)
+AudioSink::AudioSink(long const srate, int const latency, int const periods, bool const adaptive)
 : rbuf_(nearestPowerOf2(srate * latency / ((periods + 1) * 1000)) * periods * 2)
-, rateEst_(srate, rbuf_.size() / periods)
-, mut_(SDL_CreateMutex())
-, bufReadyCond_(SDL_CreateCond())
-, failed_(openAudio(srate, rbuf_.size() / 2 / periods, fillBuffer, this) < 0)
+, sampleRate_(srate)
+, periodSize_(rbuf_.size() / 2 / periods)
+, dev_(0)
+, bufReadySem_(SDL_CreateSemaphore(0))
+, adaptive_(adaptive)
+, target_(rbuf_.size())
+, minTarget_(0)
+, lastUnderruns_(0)
+, cleanSince_(getusecs())
+, holdUntil_(0)
 {
-	rbuf_.fill(0);
+	SDL_AtomicSet(&writerWaiting_, 0);
+	SDL_AtomicSet(&underruns_, 0);
+
+	// Latency is up to the ring when adaptive, so the device buffer only
+	// needs to cover scheduling jitter: about 5 ms
+	SDL_AudioSpec obtained;
+	dev_ = openAudio(srate, adaptive ? nearestPowerOf2(srate / 200) : periodSize_,
+	                 fillBuffer, this, obtained);
+	if (dev_) {
+		sampleRate_ = obtained.freq;
+		periodSize_ = obtained.samples;
+	}
+
+	// The device takes a period at a time while a frame's worth of samples
+	// is written at a time, so the ring must hold at least both
+	minTarget_ = std::min((periodSize_ + sampleRate_ / 60) * 2, rbuf_.size());
+	rateEst_.reset(new RateEst(sampleRate_, periodSize_));
+	SDL_AtomicSet(&rate_, rateEst_->result());
+	rbuf_.fill(0, target_);
 }
 
 AudioSink::~AudioSink() {
-	SDL_PauseAudio(1);
-	SDL_CloseAudio();
+	if (dev_)
+		SDL_CloseAudioDevice(dev_);
+}
+
+void AudioSink::start() {
+	if (dev_)
+		SDL_PauseAudioDevice(dev_, 0);
 }
 
-AudioSink::Status AudioSink::write(Sint16 const *inBuf, std::size_t samples) {
-	if (failed_)
-		return Status(rbuf_.size() / 2, 0, rateEst_.result());
+void AudioSink::adaptLatency() {
+	int const underruns = SDL_AtomicGet(&underruns_);
+	usec_t const now = getusecs();
+	std::size_t const step = std::max<std::size_t>(periodSize_, sampleRate_ / 1000 * 2);
+
+	if (underruns != lastUnderruns_) {
+		lastUnderruns_ = underruns;
+		target_ = std::min(target_ + target_ / 2 + step, rbuf_.size());
+		cleanSince_ = now;
+		holdUntil_ = now + adapt_hold;
+		SDL_LogDebug(SDL_LOG_CATEGORY_AUDIO, "Audio underrun, buffering %lu ms",
+		             static_cast<unsigned long>(target_ / 2 * 1000 / sampleRate_));
+	} else if (now - cleanSince_ >= adapt_window && now >= holdUntil_ && target_ > minTarget_) {
+		target_ = std::max(target_ - std::min(target_, std::max(target_ / 8, step)), minTarget_);
+		cleanSince_ = now;
+		SDL_LogDebug(SDL_LOG_CATEGORY_AUDIO, "Buffering %lu ms of audio",
+		             static_cast<unsigned long>(target_ / 2 * 1000 / sampleRate_));
+	}
+}
 
-	LockGuard lock(mut_.get());
-	Status const status(rbuf_.used() / 2, rbuf_.avail() / 2, rateEst_.result());
+AudioSink::Status AudioSink::beginWrite() {
+	if (!dev_)
+		return Status(rbuf_.size() / 2, 0, SDL_AtomicGet(&rate_));
 
-	for (std::size_t avail; (avail = rbuf_.avail() / 2) < samples;) {
-		rbuf_.write(inBuf, avail * 2);
-		inBuf += avail * 2;
-		samples -= avail;
-		SDL_CondWait(bufReadyCond_.get(), mut_.get());
+	if (adaptive_)
+		adaptLatency();
+
+	std::size_t const used = rbuf_.used();
+	return Status(used / 2, (target_ - std::min(used, target_)) / 2, SDL_AtomicGet(&rate_));
+}
+
+AudioSink::Spans AudioSink::reserve(std::size_t const minSamples, bool const block,
+                                    Status &status)
+{
+	if (!dev_) {
+		Spans const none = { 0, 0, 0, 0 };
+		return none;
 	}
 
-	rbuf_.write(inBuf, samples * 2);
-	return status;
+	std::size_t const needed = std::min(minSamples * 2, target_);
+	while (block && target_ - std::min(rbuf_.used(), target_) < needed) {
+		// Announce the wait before looking again, so that the callback
+		// either sees it or frees room that the second look sees. That
+		// takes a full barrier between the store and the load, which
+		// SDL_AtomicSet does not promise and SDL_AtomicCAS does. The flag
+		// is always clear here.
+		SDL_AtomicCAS(&writerWaiting_, 0, 1);
+		if (target_ - std::min(rbuf_.used(), target_) >= needed)
+			break;
+
+		usec_t const waitStart = getusecs();
+		SDL_SemWait(bufReadySem_.get());
+		status.blocked += getusecs() - waitStart;
+	}
+
+	SDL_AtomicSet(&writerWaiting_, 0);
+
+	SpscRing<Sint16>::Spans const room =
+		rbuf_.reserve(target_ - std::min(rbuf_.used(), target_));
+	Spans const spans = { room.first, room.firstSize / 2, room.second, room.secondSize / 2 };
+	return spans;
 }
 
 void AudioSink::read(Uint8 *const stream, std::size_t const len) {
-	if (failed_)
-		return;
+	Sint16 *const out = reinterpret_cast<Sint16 *>(stream);
+	std::size_t const n = rbuf_.read(out, len / 2);
+	if (n < len / 2) {
+		std::fill(out + n, out + len / 2, 0);
+		SDL_AtomicAdd(&underruns_, 1);
+	}
+
+	rateEst_->feed(len / 4);
+	SDL_AtomicSet(&rate_, rateEst_->result());
 
-	LockGuard lock(mut_.get());
-	rbuf_.read(reinterpret_cast<Sint16 *>(stream), std::min(len / 2, rbuf_.used()));
-	rateEst_.feed(len / 4);
-	SDL_CondSignal(bufReadyCond_.get());
+	// The other half of the handshake in reserve, with a full barrier
+	// between freeing room and looking at the flag
+	if (SDL_AtomicCAS(&writerWaiting_, 1, 0))
+		SDL_SemPost(bufReadySem_.get());
 }
@@ -19,9 +19,11 @@
 #ifndef AUDIOSINK_H
 #define AUDIOSINK_H
 
-#include <common/ringbuffer.h>
+#include "sdlutil.h"
+#include "spscring.h"
 #include <common/rateest.h>
 #include <common/scoped_ptr.h>
+#include <common/usec.h>
 #include <SDL.h>
 #include <cstddef>
 
@@ -31,31 +33,76 @@ public:
 		long fromUnderrun;
 		long fromOverflow;
 		long rate;
+		usec_t blocked;
 
 		Status(long fromUnderrun, long fromOverflow, long rate)
-		: fromUnderrun(fromUnderrun), fromOverflow(fromOverflow), rate(rate)
+		: fromUnderrun(fromUnderrun), fromOverflow(fromOverflow), rate(rate), blocked(0)
 		{
 		}
 	};
 
-	AudioSink(long sampleRate, int latency, int periods);
+	// Opens the default audio device with a buffer of up to latency ms. The
+	// device may grant another sample rate, see sampleRate(). If adaptive,
+	// a small device buffer is asked for and the amount of audio buffered
+	// ahead of it starts at latency ms, then shrinks as long as the device
+	// does not run dry and grows when it does.
+	AudioSink(long sampleRate, int latency, int periods, bool adaptive);
 	~AudioSink();
-	Status write(Sint16 const *inBuf, std::size_t samples);
+
+	long sampleRate() const { return sampleRate_; }
+	void start();
+
+	// Writing goes straight into the ring: beginWrite, then any number of
+	// reserve and commit pairs. Only one thread may write.
+
+	// Stereo samples of free room below the buffering target, as up to two
+	// spans. The second one starts at the beginning of the ring if the room
+	// wraps around.
+	struct Spans {
+		Sint16 *first;
+		std::size_t firstSize;
+		Sint16 *second;
+		std::size_t secondSize;
+	};
+
+	// Adapts the buffering target. Returns the state of the buffer.
+	Status beginWrite();
+	// Waits until there is room for at least minSamples, or as much as the
+	// target allows, unless block is false. Time spent waiting is added to
+	// status.blocked. There is no room without an audio device.
+	Spans reserve(std::size_t minSamples, bool block, Status &status);
+	// Makes samples written to the start of the reserved room playable
+	void commit(std::size_t samples) { rbuf_.commit(samples * 2); }
 
 private:
-	struct SdlDeleter;
+	// The audio callback never waits: it shares only the lock-free ring and
+	// a few atomics with the writer, and wakes the writer through a
+	// semaphore only if the writer is waiting for room.
+	SpscRing<Sint16> rbuf_;
+	long sampleRate_;
+	std::size_t periodSize_;
+	SDL_AudioDeviceID dev_;
+	scoped_ptr<RateEst> rateEst_; // audio callback only
+	SDL_atomic_t rate_;
+	SDL_atomic_t writerWaiting_;
+	SDL_atomic_t underruns_;
+	scoped_ptr<SDL_sem, SdlDeleter> const bufReadySem_;
 
-	RingBuffer<Sint16> rbuf_;
-	RateEst rateEst_;
-	scoped_ptr<SDL_mutex, SdlDeleter> const mut_;
-	scoped_ptr<SDL_cond, SdlDeleter> const bufReadyCond_;
-	bool const failed_;
+	// Adaptive latency, writer only. Samples are written until the ring
+	// holds target_ values.
+	bool const adaptive_;
+	std::size_t target_;
+	std::size_t minTarget_;
+	int lastUnderruns_;
+	usec_t cleanSince_;
+	usec_t holdUntil_;
 
 	static void fillBuffer(void *data, Uint8 *stream, int len) {
 		static_cast<AudioSink *>(data)->read(stream, len);
 	}
 
 	void read(Uint8 *stream, std::size_t len);
+	void adaptLatency();
 };
 
 #endif
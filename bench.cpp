@@ -0,0 +1,456 @@
+#include "bench.h"
+#include "audioring.h"
+#include "decimator.h"
+#include "gbframe.h"
+#include "resamplechain.h"
+#include "resamplerbench.h"
+#include "runahead.h"
+#include "spscring.h"
+
+#include <SDL.h>
+#include <common/array.h>
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static std::size_t const recorded_max = gb_sample_rate * 2;
+
+enum bench_stage {
+  STAGE_RUNFOR,
+  STAGE_RESAMPLE,
+  STAGE_TEXTURE,
+  STAGE_AUDIO_BUF,
+  STAGE_RUN_AHEAD,
+  STAGE_MAX
+};
+
+static const char *const stage_names[STAGE_MAX] = {
+    "runFor", "resampling", "texture conversion", "audio buffer", "run-ahead"};
+
+static unsigned no_input(void *) { return 0; }
+
+static double ticks_to_ms(Uint64 ticks) {
+  return ticks * 1000.0 / SDL_GetPerformanceFrequency();
+}
+
+// Times the decimator's SIMD kernel against the scalar one on a second of
+// synthetic audio fed in frame sized chunks, and checks that their output
+// is the same.
+static void bench_decimator() {
+  std::size_t const chunk = gb_samples_per_frame;
+  std::size_t const chunks = gb_sample_rate / chunk + 1;
+  Array<Sint16> const in(chunk * chunks * 2);
+  Array<Sint16> const scalarOut((Decimator::maxOut(in.size() / 2) + chunks) *
+                                 2);
+  Array<Sint16> const simdOut(scalarOut.size());
+  Sint16 *const out[2] = {scalarOut, simdOut};
+
+  // Square waves of different pitch per channel with some noise on top,
+  // covering the full sample range
+  Uint32 noise = 1;
+  for (std::size_t i = 0; i < in.size() / 2; i++) {
+    noise = noise * 1664525 + 1013904223;
+    int const n = static_cast<int>(noise >> 20) - 2048;
+    in[i * 2] = ((i / 4793) & 1 ? 30000 : -30000) + n;
+    in[i * 2 + 1] = ((i / 1171) & 1 ? 30000 : -30000) - n;
+  }
+
+  Uint64 ticks[2] = {0};
+  std::size_t outsamples[2] = {0};
+  char const *name = "";
+  for (int simd = 0; simd < 2; simd++) {
+    // Best of a few runs, to keep other load out of the comparison
+    for (int run = 0; run < 5; run++) {
+      Decimator d(chunk, simd);
+      name = d.kernelName();
+      std::size_t n = 0;
+      Uint64 const t0 = SDL_GetPerformanceCounter();
+      for (std::size_t c = 0; c < chunks; c++)
+        n += d.decimate(out[simd] + n * 2, in + c * chunk * 2, chunk);
+
+      Uint64 const t = SDL_GetPerformanceCounter() - t0;
+      if (run == 0 || t < ticks[simd])
+        ticks[simd] = t;
+
+      outsamples[simd] = n;
+    }
+  }
+
+  int maxdiff = 0;
+  for (std::size_t i = 0; i < outsamples[0] * 2; i++) {
+    int const diff = out[0][i] > out[1][i] ? out[0][i] - out[1][i]
+                                           : out[1][i] - out[0][i];
+    if (diff > maxdiff)
+      maxdiff = diff;
+  }
+
+  double const ns[2] = {ticks_to_ms(ticks[0]) * 1e6 / (in.size() / 2),
+                        ticks_to_ms(ticks[1]) * 1e6 / (in.size() / 2)};
+  printf("Decimator kernels, ns per input sample:\n");
+  printf("  %-20s %10.2f\n", "scalar", ns[0]);
+  printf("  %-20s %10.2f  %.1fx, max difference %d%s\n", name, ns[1],
+         ns[0] / ns[1], maxdiff,
+         outsamples[0] == outsamples[1] ? "" : ", output length differs");
+}
+
+// Opens a counter of last level cache misses for this thread, or returns -1
+// if the kernel or CPU does not provide one
+static int open_cache_miss_counter() {
+  struct perf_event_attr attr;
+  std::memset(&attr, 0, sizeof attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.size = sizeof attr;
+  attr.config = PERF_COUNT_HW_CACHE_MISSES;
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static long long read_counter(int fd) {
+  long long value = 0;
+  if (fd < 0 || read(fd, &value, sizeof value) != sizeof value)
+    return -1;
+
+  return value;
+}
+
+struct audio_path_result {
+  Uint64 ticks;
+  long long cache_misses;
+  unsigned long long bytes_copied;
+};
+
+// Feeds frames of audio through the frontend's audio path into a ring like
+// the one AudioSink plays from, reading the ring back like the audio callback
+// would. The old path resamples into an intermediate buffer, copies that into
+// the ring and moves the leftover input to the start of the input buffer
+// every frame. The copy-free path runs into an AudioRing and resamples
+// straight into the ring's free room, going through the intermediate buffer
+// only where the output would straddle the end of the ring.
+static audio_path_result run_audio_path(bool copy_free, long sample_rate,
+                                        bool predecimate,
+                                        std::size_t resampler_index,
+                                        Uint32 const *audio,
+                                        std::size_t samples, int fd) {
+  std::size_t const capacity =
+      gb_samples_per_frame + gambatte_max_overproduction;
+  ResampleChain chain(sample_rate, predecimate,
+                      ResamplerInfo::get(resampler_index), capacity);
+  Array<Sint16> const resampleBuf(chain.maxOut(capacity) * 2);
+  Array<Uint32> const plainBuf(copy_free ? 0 : capacity);
+  AudioRing audioRing(copy_free ? capacity : 1);
+  // About 100 ms of output, and a device period to read it into
+  SpscRing<Sint16> ring(sample_rate / 10 * 2);
+  Array<Sint16> const period(1024 * 2);
+  audio_path_result result = {0, 0, 0};
+
+  if (fd >= 0) {
+    ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+  }
+
+  Uint64 const start = SDL_GetPerformanceCounter();
+  std::size_t bufsamples = 0, pos = 0;
+  for (long frame = 0; pos + gb_samples_per_frame <= samples; frame++) {
+    // Stands in for runFor: a frame is done a varying number of samples
+    // into the last run, and the rest stays buffered
+    Uint32 *const in = copy_free ? audioRing.front() : plainBuf.get();
+    std::size_t const runsamples = gb_samples_per_frame - bufsamples;
+    std::memcpy(in + bufsamples, audio + pos, runsamples * sizeof *in);
+    pos += runsamples;
+    std::size_t const overrun = frame * 977 % gambatte_max_overproduction;
+    std::size_t const outsamples =
+        bufsamples + runsamples - std::min(overrun, bufsamples + runsamples);
+    bufsamples = bufsamples + runsamples - outsamples;
+
+    Sint16 const *const src = reinterpret_cast<Sint16 const *>(in);
+    std::size_t const out_max = chain.maxOut(outsamples);
+    SpscRing<Sint16>::Spans const room = ring.reserve(out_max * 2);
+    if (copy_free && room.firstSize >= out_max * 2) {
+      ring.commit(chain.resample(room.first, src, outsamples) * 2);
+    } else {
+      std::size_t const n = chain.resample(resampleBuf, src, outsamples);
+      result.bytes_copied +=
+          ring.write(resampleBuf, n * 2) * sizeof *resampleBuf;
+    }
+
+    if (copy_free) {
+      audioRing.consume(outsamples, bufsamples);
+    } else {
+      std::memmove(plainBuf, plainBuf + outsamples,
+                   bufsamples * sizeof *plainBuf);
+      result.bytes_copied += bufsamples * sizeof *plainBuf;
+    }
+
+    while (ring.used() >= period.size())
+      ring.read(period, period.size());
+  }
+
+  result.ticks = SDL_GetPerformanceCounter() - start;
+  if (fd >= 0)
+    ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+
+  result.cache_misses = read_counter(fd);
+  return result;
+}
+
+// Compares the old audio path with the copy-free one on the recorded audio
+static void bench_audio_path(long sample_rate, bool predecimate,
+                             std::size_t resampler_index,
+                             Uint32 const *audio, std::size_t samples) {
+  int const fd = open_cache_miss_counter();
+  audio_path_result results[2];
+  for (int copy_free = 0; copy_free < 2; copy_free++) {
+    // Best of a few runs, to keep other load out of the comparison
+    for (int run = 0; run < 5; run++) {
+      audio_path_result const r =
+          run_audio_path(copy_free, sample_rate, predecimate, resampler_index,
+                         audio, samples, fd);
+      if (run == 0 || r.ticks < results[copy_free].ticks)
+        results[copy_free] = r;
+    }
+  }
+
+  if (fd >= 0)
+    close(fd);
+
+  std::size_t const frames = samples / gb_samples_per_frame;
+  if (frames == 0)
+    return;
+
+  static const char *const names[2] = {"copy to ring, memmove", "copy-free"};
+  printf("Audio path, per frame:\n");
+  printf("  %-22s %10s %14s %14s\n", "", "us", "bytes copied", "cache misses");
+  for (int i = 0; i < 2; i++) {
+    char misses[32] = "n/a";
+    if (results[i].cache_misses >= 0)
+      snprintf(misses, sizeof misses, "%.1f",
+               results[i].cache_misses / static_cast<double>(frames));
+
+    printf("  %-22s %10.2f %14.0f %14s\n", names[i],
+           ticks_to_ms(results[i].ticks) * 1000 / frames,
+           results[i].bytes_copied / static_cast<double>(frames), misses);
+  }
+}
+
+// Resamples the recorded audio with and without predecimation and prints
+// how far the predecimated output is from the full rate one, after lining
+// the two up for their different filter delays
+static void compare_predecimation(long sample_rate,
+                                  std::size_t resampler_index,
+                                  Uint32 const *audio, std::size_t samples) {
+  std::size_t const chunk = gb_samples_per_frame;
+  std::size_t const chunks = (samples + chunk - 1) / chunk;
+  Array<Sint16> out[2];
+  std::size_t outsamples[2] = {0, 0};
+  for (int predecimate = 0; predecimate < 2; predecimate++) {
+    ResampleChain chain(sample_rate, predecimate,
+                        ResamplerInfo::get(resampler_index), chunk);
+    out[predecimate].reset(chain.maxOut(chunk) * chunks * 2);
+    for (std::size_t i = 0; i < samples; i += chunk) {
+      std::size_t const n = samples - i < chunk ? samples - i : chunk;
+      outsamples[predecimate] += chain.resample(
+          out[predecimate] + outsamples[predecimate] * 2,
+          reinterpret_cast<Sint16 const *>(audio + i), n);
+    }
+  }
+
+  // Lag of the predecimated output that correlates best with the full rate
+  // one
+  int const max_lag = 256;
+  std::size_t const len = outsamples[0] < outsamples[1] ? outsamples[0]
+                                                        : outsamples[1];
+  if (len <= 2 * max_lag)
+    return;
+
+  int best_lag = 0;
+  double best_corr = 0;
+  for (int lag = -max_lag; lag <= max_lag; lag++) {
+    double corr = 0;
+    for (std::size_t i = max_lag; i < len - max_lag; i++)
+      corr += static_cast<double>(out[0][i * 2]) * out[1][(i + lag) * 2] +
+              static_cast<double>(out[0][i * 2 + 1]) *
+                  out[1][(i + lag) * 2 + 1];
+
+    if (lag == -max_lag || corr > best_corr) {
+      best_corr = corr;
+      best_lag = lag;
+    }
+  }
+
+  double signal = 0;
+  double noise = 0;
+  int maxdiff = 0;
+  for (std::size_t i = max_lag * 2; i < (len - max_lag) * 2; i++) {
+    int const ref = out[0][i];
+    int const diff = out[1][i + best_lag * 2] - ref;
+    signal += static_cast<double>(ref) * ref;
+    noise += static_cast<double>(diff) * diff;
+    if (std::abs(diff) > maxdiff)
+      maxdiff = std::abs(diff);
+  }
+
+  printf("Predecimated against full rate output:\n");
+  if (noise > 0 && signal > 0)
+    printf("  difference %.1f dB below the signal",
+           10 * std::log10(signal / noise));
+  else
+    printf("  no difference");
+  printf(", max %d, predecimated output %+d samples late\n", maxdiff,
+         best_lag);
+}
+
+int run_benchmark(gambatte::GB *gb, long frames, long sample_rate,
+                  int run_ahead, bool predecimate,
+                  std::size_t resampler_index, double cpu_budget,
+                  input_movie *movie) {
+  AudioRing audioRing(gb_samples_per_frame + gambatte_max_overproduction);
+  // Same audio pipeline as AudioOut
+  ResampleChain chain(sample_rate, predecimate,
+                      ResamplerInfo::get(resampler_index),
+                      audioRing.capacity());
+  Array<Sint16> const resampleBuf(chain.maxOut(audioRing.capacity()) * 2);
+  Array<Uint32> const recorded(recorded_max);
+  std::size_t recorded_samples = 0;
+
+  // Frames are rendered into a buffer laid out like a locked streaming
+  // texture and then copied out, standing in for the texture upload
+  std::ptrdiff_t const pitch = gb_screen_width + 16;
+  Array<uint_least32_t> const videoBuf(pitch * gb_screen_height);
+  Array<uint_least32_t> const textureBuf(gb_screen_width * gb_screen_height);
+  std::memset(videoBuf, 0, videoBuf.size() * sizeof *videoBuf);
+  RunAhead runAhead(run_ahead, audioRing.capacity());
+
+  if (movie != NULL)
+    gb->setInputGetter(&movie_get_input, movie);
+  else
+    gb->setInputGetter(&no_input, NULL);
+
+  // FNV-1a over every pixel of every frame
+  Uint64 frame_hash = 14695981039346656037ull;
+
+  Uint64 stage_ticks[STAGE_MAX] = {0};
+  std::size_t bufsamples = 0;
+  unsigned long long samples_emulated = 0;
+  long frames_done = 0;
+
+  printf("Running benchmark for %ld frames...\n", frames);
+
+  Uint64 const start = SDL_GetPerformanceCounter();
+
+  while (frames_done < frames) {
+    Uint64 t0 = SDL_GetPerformanceCounter();
+
+    Uint32 *const audioBuf = audioRing.front();
+    std::size_t runsamples = gb_samples_per_frame - bufsamples;
+    std::ptrdiff_t const vidFrameDoneSampleCnt =
+        gb->runFor(videoBuf, pitch, audioBuf + bufsamples, runsamples);
+    std::size_t const outsamples = vidFrameDoneSampleCnt >= 0
+                                       ? bufsamples + vidFrameDoneSampleCnt
+                                       : bufsamples + runsamples;
+    bufsamples += runsamples;
+    bufsamples -= outsamples;
+    samples_emulated += runsamples;
+
+    Uint64 t1 = SDL_GetPerformanceCounter();
+    stage_ticks[STAGE_RUNFOR] += t1 - t0;
+
+    if (vidFrameDoneSampleCnt >= 0 && run_ahead > 0) {
+      if (movie != NULL)
+        movie->speculating = true;
+      bool const ranAhead = runAhead.run(*gb, videoBuf, pitch);
+      if (movie != NULL)
+        movie->speculating = false;
+      if (!ranAhead) {
+        printf("Save states failed, cannot run ahead\n");
+        return 1;
+      }
+
+      Uint64 const t = SDL_GetPerformanceCounter();
+      stage_ticks[STAGE_RUN_AHEAD] += t - t1;
+      t1 = t;
+    }
+
+    if (vidFrameDoneSampleCnt >= 0) {
+      for (int y = 0; y < gb_screen_height; y++)
+        std::memcpy(textureBuf + y * gb_screen_width, videoBuf + y * pitch,
+                    gb_screen_width * sizeof *videoBuf);
+
+      ++frames_done;
+    }
+
+    Uint64 t2 = SDL_GetPerformanceCounter();
+    stage_ticks[STAGE_TEXTURE] += t2 - t1;
+
+    // Kept for comparing runs, outside of the timed stages
+    if (movie != NULL && vidFrameDoneSampleCnt >= 0) {
+      for (std::size_t i = 0; i < textureBuf.size(); i++) {
+        frame_hash ^= textureBuf[i];
+        frame_hash *= 1099511628211ull;
+      }
+      t2 = SDL_GetPerformanceCounter();
+    }
+
+    chain.resample(resampleBuf,
+                   reinterpret_cast<Sint16 const *>(audioBuf),
+                   outsamples);
+
+    Uint64 t3 = SDL_GetPerformanceCounter();
+    stage_ticks[STAGE_RESAMPLE] += t3 - t2;
+
+    // Kept for comparing resamplers, outside of the timed stages
+    if (recorded_samples < recorded_max) {
+      std::size_t const n = outsamples < recorded_max - recorded_samples
+                                ? outsamples
+                                : recorded_max - recorded_samples;
+      std::memcpy(recorded + recorded_samples, audioBuf, n * sizeof *audioBuf);
+      recorded_samples += n;
+      t3 = SDL_GetPerformanceCounter();
+    }
+
+    audioRing.consume(outsamples, bufsamples);
+
+    stage_ticks[STAGE_AUDIO_BUF] += SDL_GetPerformanceCounter() - t3;
+  }
+
+  double const wall_ms = ticks_to_ms(SDL_GetPerformanceCounter() - start);
+  double const emulated_ms = samples_emulated * 1000.0 / gb_sample_rate;
+
+  printf("Emulated %ld frames (%.1f s) in %.1f s\n", frames_done,
+         emulated_ms / 1000, wall_ms / 1000);
+  printf("  %.1f frames/s, %.2fx realtime\n", frames_done * 1000.0 / wall_ms,
+         emulated_ms / wall_ms);
+  if (movie != NULL)
+    printf("  frame hash %016llx\n", (unsigned long long)frame_hash);
+
+  for (int i = 0; i < (run_ahead > 0 ? STAGE_MAX : STAGE_RUN_AHEAD); i++) {
+    double const ms = ticks_to_ms(stage_ticks[i]);
+    printf("  %-20s %10.1f ms  %8.1f us/frame  %5.1f%%\n", stage_names[i], ms,
+           ms * 1000 / frames_done, ms * 100 / wall_ms);
+  }
+
+  if (predecimate) {
+    bench_decimator();
+    if (recorded_samples > 0)
+      compare_predecimation(sample_rate, resampler_index, recorded,
+                            recorded_samples);
+  }
+
+  if (recorded_samples > 0)
+    bench_audio_path(sample_rate, predecimate, resampler_index, recorded,
+                     recorded_samples);
+
+  if (recorded_samples > 0)
+    print_resampler_table(sample_rate, predecimate, cpu_budget,
+                          reinterpret_cast<Sint16 const *>(recorded.get()),
+                          recorded_samples);
+
+  return 0;
+}
@@ -0,0 +1,26 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include "gambatte.h"
+#include "movie.h"
+#include <cstddef>
+
+// Runs the loaded ROM headlessly for the given number of video frames as fast
+// as possible and prints throughput and a per-stage timing breakdown. With
+// run_ahead > 0, each frame also runs that many frames ahead like the main
+// loop does, so its cost shows up in the breakdown. Audio is decimated ahead
+// of the resampler when predecimate is set, and the decimator's SIMD kernel
+// is then timed against the scalar one and the recorded audio's resampled
+// output compared with the full rate path. The first seconds of audio are
+// recorded, run through the old and the copy-free audio path to compare
+// their cost and cache misses, and fed through every resampler to compare
+// them, marking the one that would be picked for cpu_budget.
+//
+// With a movie, its input is replayed and a hash of all frames is printed,
+// which must come out the same on every build and run.
+int run_benchmark(gambatte::GB *gb, long frames, long sample_rate,
+                  int run_ahead, bool predecimate,
+                  std::size_t resampler_index, double cpu_budget,
+                  input_movie *movie);
+
+#endif
@@ -0,0 +1,152 @@
+#include "bootcache.h"
+#include "littleendian.h"
+#include "safefile.h"
+#include "SDL_log.h"
+#include <common/array.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+// Cache files are a magic number, the CRCs of the ROM and the BIOS, each 4
+// bytes little endian, followed by the state
+enum { header_size = 12 };
+unsigned long const cache_magic = 0x31434247; // "GBC1"
+
+// While the boot ROM runs, the emulator is run this many samples (twice as
+// many CPU cycles) at a time, so that the game runs at most a few
+// instructions before the hand-over is seen
+std::size_t const boot_step_samples = 4;
+
+// The boot ROM is mapped over the first 256 bytes of the cartridge ROM
+std::size_t const boot_overlay_size = 0x100;
+
+unsigned long crc(char const *data, std::size_t size) {
+	return crc32(crc32(0, 0, 0), reinterpret_cast<Bytef const *>(data), size);
+}
+
+std::string cacheFilename(std::string const &dir, unsigned long romCrc, unsigned long biosCrc) {
+	char name[32];
+	std::sprintf(name, "boot-%08lx%08lx.state", romCrc, biosCrc);
+	return dir + name;
+}
+
+} // anon ns
+
+BootCache::BootCache(std::string const &dir, char const *const rom, std::size_t const romSize,
+                     char const *const bios, std::size_t const biosSize)
+: romCrc_(crc(rom, romSize))
+, biosCrc_(crc(bios, biosSize))
+, filename_(cacheFilename(dir, romCrc_, biosCrc_))
+, probes_(0)
+, frames_(0)
+, restored_(false)
+, thread_(0)
+{
+	// The hand-over shows as the first bytes reading as the cartridge ROM
+	// instead of the boot ROM. Watch some of the bytes that differ.
+	std::size_t const n = std::min(boot_overlay_size, std::min(romSize, biosSize));
+	for (std::size_t i = 0; i < n && probes_ < max_probes; ++i) {
+		if (rom[i] != bios[i]) {
+			probeAddr_[probes_] = i;
+			probeRom_[probes_] = rom[i];
+			++probes_;
+		}
+	}
+}
+
+BootCache::~BootCache() {
+	if (thread_)
+		SDL_WaitThread(thread_, 0);
+}
+
+bool BootCache::restore(gambatte::GB &gb) {
+	Array<char> file;
+	if (!readFile(filename_, file))
+		return false;
+
+	unsigned char const *const in = reinterpret_cast<unsigned char const *>(file.get());
+	if (file.size() <= header_size || get32(in) != cache_magic
+			|| get32(in + 4) != romCrc_ || get32(in + 8) != biosCrc_) {
+		return false;
+	}
+
+	// The state includes cartridge RAM from when it was cached
+	Array<char> const savedata(gb.getSavedataLength());
+	gb.saveSavedata(savedata);
+	if (!gb.loadState(file + header_size, file.size() - header_size))
+		return false;
+
+	gb.loadSavedata(savedata);
+	restored_ = true;
+	return true;
+}
+
+bool BootCache::handedOver(gambatte::GB &gb) const {
+	for (int i = 0; i < probes_; ++i) {
+		if (gb.externalRead(probeAddr_[i]) != probeRom_[i])
+			return false;
+	}
+
+	return true;
+}
+
+std::ptrdiff_t BootCache::runFor(gambatte::GB &gb, gambatte::uint_least32_t *const videoBuf,
+                                 std::ptrdiff_t const pitch,
+                                 gambatte::uint_least32_t *const audioBuf,
+                                 std::size_t &samples)
+{
+	if (!watching())
+		return gb.runFor(videoBuf, pitch, audioBuf, samples);
+
+	// Each step may overproduce like a single run would, which the caller
+	// leaves room for
+	std::size_t done = 0;
+	while (done < samples) {
+		std::size_t n = std::min(boot_step_samples, samples - done);
+		std::ptrdiff_t const frameDone = gb.runFor(videoBuf, pitch, audioBuf + done, n);
+		done += n;
+
+		if (watching() && handedOver(gb)) {
+			if (state_.save(gb))
+				thread_ = SDL_CreateThread(writerThread, "bootcache", this);
+			else
+				frames_ = max_boot_frames;
+		}
+
+		if (frameDone >= 0) {
+			samples = done;
+			return static_cast<std::ptrdiff_t>(done - n) + frameDone;
+		}
+	}
+
+	samples = done;
+	return -1;
+}
+
+bool BootCache::frame() {
+	if (!watching())
+		return false;
+
+	return ++frames_ < max_boot_frames;
+}
+
+int BootCache::writerThread(void *const data) {
+	static_cast<BootCache *>(data)->write();
+	return 0;
+}
+
+void BootCache::write() {
+	Array<unsigned char> const out(header_size + state_.size());
+	put32(out, cache_magic);
+	put32(out + 4, romCrc_);
+	put32(out + 8, biosCrc_);
+	std::memcpy(out + header_size, state_.data(), state_.size());
+
+	if (writeFileSafely(filename_, out, out.size()))
+		SDL_Log("Cached boot state in %s", filename_.c_str());
+	else
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not write %s", filename_.c_str());
+}
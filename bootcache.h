@@ -0,0 +1,62 @@
+#ifndef BOOT_CACHE_H_
+#define BOOT_CACHE_H_
+
+#include "gambatte.h"
+#include "statebuffer.h"
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <cstddef>
+#include <string>
+
+// Skips the boot ROM on later launches. The first time a ROM is run with a
+// BIOS, the machine state is saved right after the boot ROM hands over to
+// the game. Later launches with the same ROM and BIOS load that state
+// instead of running the boot ROM again. Cache files are named after a hash
+// of both files, so changing either one misses the cache.
+class BootCache {
+public:
+	BootCache(std::string const &dir, char const *rom, std::size_t romSize,
+	          char const *bios, std::size_t biosSize);
+	// Waits for the cache file to be written
+	~BootCache();
+
+	// Loads the cached state, keeping the cartridge RAM already loaded.
+	// Returns false if there is no cached state.
+	bool restore(gambatte::GB &gb);
+	bool restored() const { return restored_; }
+
+	// Runs gb like GB::runFor while the boot ROM runs. It is run in short
+	// steps, and the state is saved in the background as soon as the boot
+	// ROM has handed over to the game, before the game gets to read
+	// cartridge RAM into work RAM, which restore would not undo.
+	std::ptrdiff_t runFor(gambatte::GB &gb, gambatte::uint_least32_t *videoBuf,
+	                      std::ptrdiff_t pitch, gambatte::uint_least32_t *audioBuf,
+	                      std::size_t &samples);
+
+	// Call after every frame while it returns true. Gives up on a boot ROM
+	// that does not seem to hand over.
+	bool frame();
+
+private:
+	enum { max_probes = 8 };
+	// Gives up on finding the hand-over after this many frames
+	enum { max_boot_frames = 60 * 10 };
+
+	unsigned long const romCrc_;
+	unsigned long const biosCrc_;
+	std::string const filename_;
+	unsigned short probeAddr_[max_probes];
+	unsigned char probeRom_[max_probes];
+	int probes_;
+	int frames_;
+	bool restored_;
+	StateBuffer state_;
+	SDL_Thread *thread_;
+
+	bool watching() const { return probes_ && !restored_ && !thread_ && frames_ < max_boot_frames; }
+	bool handedOver(gambatte::GB &gb) const;
+	static int writerThread(void *data);
+	void write();
+};
+
+#endif
@@ -0,0 +1,172 @@
+#include "capture.h"
+#include "SDL_log.h"
+#include <cstring>
+#include <string>
+
+namespace {
+
+enum { queue_frames = 64 };   // about a second of video
+enum { audio_seconds = 2 };
+
+static bool hasSuffix(char const *s, char const *suffix) {
+	std::size_t const len = std::strlen(s), suffixLen = std::strlen(suffix);
+	return len >= suffixLen && std::strcmp(s + len - suffixLen, suffix) == 0;
+}
+
+} // anon ns
+
+Capture::Capture(char const *filename, int const width, int const height, long const sampleRate)
+: width_(width)
+, height_(height)
+, y4m_(hasSuffix(filename, ".y4m"))
+, file_(std::fopen(filename, "wb"))
+, frames_(std::size_t(width) * height * queue_frames)
+, scratch_(std::size_t(width) * height)
+, out_(std::size_t(width) * height * 3)
+, audio_(sampleRate * 2 * audio_seconds)
+, audioOut_(audio_.size())
+, mut_(SDL_CreateMutex())
+, cond_(SDL_CreateCond())
+, writing_(slot(0))
+, head_(0)
+, tail_(0)
+, count_(0)
+, droppedFrames_(0)
+, droppedSamples_(0)
+, stop_(false)
+, thread_(0)
+{
+	if (!file_) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot open capture file %s", filename);
+		return;
+	}
+
+	if (y4m_) {
+		// Exact Game Boy frame rate: 4194304 Hz / 70224 cycles per frame
+		std::fprintf(file_, "YUV4MPEG2 W%d H%d F4194304:70224 Ip A1:1 C444 XCOLORRANGE=FULL\n",
+		             width, height);
+	}
+
+	wav_.open((std::string(filename) + ".wav").c_str(), sampleRate, 2);
+
+	thread_ = SDL_CreateThread(writerThread, "capture", this);
+	SDL_Log("Capturing %s video to %s", y4m_ ? "Y4M" : "raw RGB24", filename);
+}
+
+Capture::~Capture() {
+	if (thread_) {
+		{
+			LockGuard lock(mut_.get());
+			stop_ = true;
+			SDL_CondSignal(cond_.get());
+		}
+
+		SDL_WaitThread(thread_, 0);
+	}
+
+	if (droppedFrames_ || droppedSamples_) {
+		SDL_LogWarn(SDL_LOG_CATEGORY_SYSTEM, "Capture dropped %lu frames and %lu audio samples",
+		            droppedFrames_, droppedSamples_);
+	}
+
+	wav_.close();
+	if (file_)
+		std::fclose(file_);
+}
+
+gambatte::uint_least32_t * Capture::slot(std::size_t const n) const {
+	return frames_ + n * width_ * height_;
+}
+
+void Capture::upload() {
+	LockGuard lock(mut_.get());
+
+	if (writing_ == scratch_.get()) {
+		// Rendered while the queue was full
+		++droppedFrames_;
+	} else {
+		++count_;
+		head_ = (head_ + 1) % queue_frames;
+		SDL_CondSignal(cond_.get());
+	}
+
+	writing_ = count_ < queue_frames ? slot(head_) : scratch_.get();
+}
+
+void Capture::upload(gambatte::uint_least32_t const *const frame, std::ptrdiff_t const pitch) {
+	for (int y = 0; y < height_; ++y)
+		std::memcpy(writing_ + y * width_, frame + y * pitch, width_ * sizeof *frame);
+
+	upload();
+}
+
+void Capture::writeAudio(Sint16 const *const samples, std::size_t const frames) {
+	LockGuard lock(mut_.get());
+
+	std::size_t const n = std::min(frames, audio_.avail() / 2);
+	audio_.write(samples, n * 2);
+	droppedSamples_ += frames - n;
+	SDL_CondSignal(cond_.get());
+}
+
+int Capture::writerThread(void *const data) {
+	static_cast<Capture *>(data)->run();
+	return 0;
+}
+
+void Capture::run() {
+	for (;;) {
+		gambatte::uint_least32_t const *frame = 0;
+		std::size_t audioSamples = 0;
+
+		{
+			LockGuard lock(mut_.get());
+			while (!count_ && !audio_.used() && !stop_)
+				SDL_CondWait(cond_.get(), mut_.get());
+
+			if (!count_ && !audio_.used())
+				return;
+
+			if (count_)
+				frame = slot(tail_);
+
+			audioSamples = audio_.used();
+			audio_.read(audioOut_, audioSamples);
+		}
+
+		wav_.write(audioOut_, audioSamples / 2);
+
+		if (frame) {
+			writeFrame(frame);
+
+			LockGuard lock(mut_.get());
+			tail_ = (tail_ + 1) % queue_frames;
+			--count_;
+		}
+	}
+}
+
+void Capture::writeFrame(gambatte::uint_least32_t const *const frame) {
+	std::size_t const pixels = std::size_t(width_) * height_;
+	unsigned char *const out = out_;
+
+	if (y4m_) {
+		// BT.601 full range, planar Y, Cb, Cr
+		for (std::size_t i = 0; i < pixels; ++i) {
+			int const r = frame[i] >> 16 & 0xff, g = frame[i] >> 8 & 0xff, b = frame[i] & 0xff;
+			out[i] = (77 * r + 150 * g + 29 * b + 128) >> 8;
+			out[pixels + i] = ((-43 * r - 85 * g + 128 * b) >> 8) + 128;
+			out[pixels * 2 + i] = ((128 * r - 107 * g - 21 * b) >> 8) + 128;
+		}
+
+		std::fputs("FRAME\n", file_);
+	} else {
+		for (std::size_t i = 0; i < pixels; ++i) {
+			out[i * 3] = frame[i] >> 16 & 0xff;
+			out[i * 3 + 1] = frame[i] >> 8 & 0xff;
+			out[i * 3 + 2] = frame[i] & 0xff;
+		}
+	}
+
+	std::fwrite(out, 1, pixels * 3, file_);
+}
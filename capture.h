@@ -0,0 +1,66 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include "sdlutil.h"
+#include "videosink.h"
+#include "wavwriter.h"
+#include <common/array.h>
+#include <common/ringbuffer.h>
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <cstddef>
+#include <cstdio>
+
+// Video sink streaming every frame to a file: YUV4MPEG2 (4:4:4) if the file
+// name ends in .y4m, raw RGB24 otherwise. Audio handed to writeAudio goes to
+// a WAV file next to it (the file name with .wav appended).
+//
+// Frames and audio pass through bounded queues that a writer thread drains,
+// so disk I/O never holds up the emulator. If the writer falls behind, new
+// data is dropped (and counted) rather than waited for.
+class Capture : public VideoSink {
+public:
+	Capture(char const *filename, int width, int height, long sampleRate);
+	virtual ~Capture();
+
+	bool failed() const { return !file_; }
+
+	virtual gambatte::uint_least32_t * frameBuf() const { return writing_; }
+	virtual std::ptrdiff_t pitch() const { return width_; }
+	virtual void upload();
+	virtual void upload(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch);
+	virtual bool present() { return false; }
+
+	// Queues stereo samples for the WAV file.
+	void writeAudio(Sint16 const *samples, std::size_t frames);
+
+private:
+	int const width_;
+	int const height_;
+	bool const y4m_;
+	std::FILE *file_;
+	WavWriter wav_;
+	Array<gambatte::uint_least32_t> const frames_;
+	Array<gambatte::uint_least32_t> const scratch_;
+	Array<unsigned char> const out_;
+	RingBuffer<Sint16> audio_;
+	Array<Sint16> const audioOut_;
+	scoped_ptr<SDL_mutex, SdlDeleter> const mut_;
+	scoped_ptr<SDL_cond, SdlDeleter> const cond_;
+	gambatte::uint_least32_t *writing_;
+	std::size_t head_;
+	std::size_t tail_;
+	std::size_t count_;
+	unsigned long droppedFrames_;
+	unsigned long droppedSamples_;
+	bool stop_;
+	SDL_Thread *thread_;
+
+	gambatte::uint_least32_t * slot(std::size_t n) const;
+	static int writerThread(void *data);
+	void run();
+	void writeFrame(gambatte::uint_least32_t const *frame);
+};
+
+#endif
@@ -0,0 +1,277 @@
+#include "decimator.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define DECIMATOR_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define DECIMATOR_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define DECIMATOR_NEON 1
+#endif
+
+namespace {
+
+// Three moving sums of 16 samples make a 46 tap filter. The taps are padded
+// with zeros to a multiple of 16 so that the kernels need no tail loop.
+enum { taps = 3 * Decimator::FACTOR - 2 };
+enum { padded_taps = 48 };
+// The coefficients add up to 16^3
+enum { coef_shift = 12 };
+
+struct Coefs {
+	Sint16 values[padded_taps];
+
+	Coefs() {
+		int box[taps] = { 0 };
+		for (int i = 0; i < Decimator::FACTOR; ++i) {
+			for (int j = 0; j < Decimator::FACTOR; ++j) {
+				for (int k = 0; k < Decimator::FACTOR; ++k)
+					++box[i + j + k];
+			}
+		}
+
+		for (int i = 0; i < padded_taps; ++i)
+			values[i] = i < taps ? box[i] : 0;
+	}
+};
+
+Coefs const coefs;
+
+inline Sint16 scaleSum(int sum) {
+	return (sum + (1 << (coef_shift - 1))) >> coef_shift;
+}
+
+// Each input sample takes part in three output samples, so the input is
+// split into one buffer per channel once instead of the filters picking
+// the channels apart for every output sample.
+
+void deinterleaveGeneric(Sint16 *l, Sint16 *r, Sint16 const *in, std::size_t const samples) {
+	for (std::size_t i = 0; i < samples; ++i) {
+		l[i] = in[i * 2];
+		r[i] = in[i * 2 + 1];
+	}
+}
+
+void filterGeneric(Sint16 *out, Sint16 const *l, Sint16 const *r,
+                   std::size_t const outSamples, Sint16 const *const c)
+{
+	for (std::size_t n = 0; n < outSamples; ++n) {
+		int suml = 0, sumr = 0;
+		for (int i = 0; i < padded_taps; ++i) {
+			suml += c[i] * l[i];
+			sumr += c[i] * r[i];
+		}
+
+		out[0] = scaleSum(suml);
+		out[1] = scaleSum(sumr);
+		out += 2;
+		l += Decimator::FACTOR;
+		r += Decimator::FACTOR;
+	}
+}
+
+#ifdef DECIMATOR_SSE2
+
+// Sign extends the left or right samples of 4 stereo pairs to 32 bits
+inline __m128i left32(__m128i v) { return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16); }
+inline __m128i right32(__m128i v) { return _mm_srai_epi32(v, 16); }
+
+// Adds the 32 bit lanes of l and r, returning the sums in lanes 0 and 2
+inline __m128i sumLanes(__m128i l, __m128i r) {
+	__m128i const lr = _mm_add_epi32(_mm_unpacklo_epi64(l, r), _mm_unpackhi_epi64(l, r));
+	return _mm_add_epi32(lr, _mm_shuffle_epi32(lr, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+inline void storeSums(Sint16 *out, __m128i sums) {
+	out[0] = scaleSum(_mm_cvtsi128_si32(sums));
+	out[1] = scaleSum(_mm_cvtsi128_si32(_mm_shuffle_epi32(sums, _MM_SHUFFLE(2, 2, 2, 2))));
+}
+
+void deinterleaveSse2(Sint16 *l, Sint16 *r, Sint16 const *in, std::size_t const samples) {
+	std::size_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		__m128i const a = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i * 2));
+		__m128i const b = _mm_loadu_si128(reinterpret_cast<__m128i const *>(in + i * 2 + 8));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(l + i),
+		                 _mm_packs_epi32(left32(a), left32(b)));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(r + i),
+		                 _mm_packs_epi32(right32(a), right32(b)));
+	}
+
+	deinterleaveGeneric(l + i, r + i, in + i * 2, samples - i);
+}
+
+void filterSse2(Sint16 *out, Sint16 const *l, Sint16 const *r,
+                std::size_t const outSamples, Sint16 const *const c)
+{
+	__m128i k[padded_taps / 8];
+	for (int i = 0; i < padded_taps / 8; ++i)
+		k[i] = _mm_loadu_si128(reinterpret_cast<__m128i const *>(c + i * 8));
+
+	for (std::size_t n = 0; n < outSamples; ++n) {
+		__m128i suml = _mm_setzero_si128(), sumr = _mm_setzero_si128();
+		for (int i = 0; i < padded_taps / 8; ++i) {
+			__m128i const vl = _mm_loadu_si128(reinterpret_cast<__m128i const *>(l + i * 8));
+			__m128i const vr = _mm_loadu_si128(reinterpret_cast<__m128i const *>(r + i * 8));
+			suml = _mm_add_epi32(suml, _mm_madd_epi16(vl, k[i]));
+			sumr = _mm_add_epi32(sumr, _mm_madd_epi16(vr, k[i]));
+		}
+
+		storeSums(out, sumLanes(suml, sumr));
+		out += 2;
+		l += Decimator::FACTOR;
+		r += Decimator::FACTOR;
+	}
+}
+
+#endif
+
+#ifdef DECIMATOR_AVX2
+
+__attribute__((target("avx2")))
+void deinterleaveAvx2(Sint16 *l, Sint16 *r, Sint16 const *in, std::size_t const samples) {
+	std::size_t i = 0;
+	for (; i + 16 <= samples; i += 16) {
+		__m256i const a = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i * 2));
+		__m256i const b = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(in + i * 2 + 16));
+		__m256i const vl = _mm256_packs_epi32(_mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16),
+		                                      _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16));
+		__m256i const vr = _mm256_packs_epi32(_mm256_srai_epi32(a, 16), _mm256_srai_epi32(b, 16));
+		// Packing works within 128 bit lanes, which leaves the middle
+		// quarters swapped
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(l + i),
+		                    _mm256_permute4x64_epi64(vl, _MM_SHUFFLE(3, 1, 2, 0)));
+		_mm256_storeu_si256(reinterpret_cast<__m256i *>(r + i),
+		                    _mm256_permute4x64_epi64(vr, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+
+	deinterleaveGeneric(l + i, r + i, in + i * 2, samples - i);
+}
+
+__attribute__((target("avx2")))
+void filterAvx2(Sint16 *out, Sint16 const *l, Sint16 const *r,
+                std::size_t const outSamples, Sint16 const *const c)
+{
+	__m256i k[padded_taps / 16];
+	for (int i = 0; i < padded_taps / 16; ++i)
+		k[i] = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(c + i * 16));
+
+	for (std::size_t n = 0; n < outSamples; ++n) {
+		__m256i suml = _mm256_setzero_si256(), sumr = _mm256_setzero_si256();
+		for (int i = 0; i < padded_taps / 16; ++i) {
+			__m256i const vl = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(l + i * 16));
+			__m256i const vr = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(r + i * 16));
+			suml = _mm256_add_epi32(suml, _mm256_madd_epi16(vl, k[i]));
+			sumr = _mm256_add_epi32(sumr, _mm256_madd_epi16(vr, k[i]));
+		}
+
+		storeSums(out, sumLanes(
+			_mm_add_epi32(_mm256_castsi256_si128(suml), _mm256_extracti128_si256(suml, 1)),
+			_mm_add_epi32(_mm256_castsi256_si128(sumr), _mm256_extracti128_si256(sumr, 1))));
+		out += 2;
+		l += Decimator::FACTOR;
+		r += Decimator::FACTOR;
+	}
+}
+
+#endif
+
+#ifdef DECIMATOR_NEON
+
+void deinterleaveNeon(Sint16 *l, Sint16 *r, Sint16 const *in, std::size_t const samples) {
+	std::size_t i = 0;
+	for (; i + 8 <= samples; i += 8) {
+		int16x8x2_t const lr = vld2q_s16(in + i * 2);
+		vst1q_s16(l + i, lr.val[0]);
+		vst1q_s16(r + i, lr.val[1]);
+	}
+
+	deinterleaveGeneric(l + i, r + i, in + i * 2, samples - i);
+}
+
+void filterNeon(Sint16 *out, Sint16 const *l, Sint16 const *r,
+                std::size_t const outSamples, Sint16 const *const c)
+{
+	for (std::size_t n = 0; n < outSamples; ++n) {
+		int32x4_t suml = vdupq_n_s32(0), sumr = vdupq_n_s32(0);
+		for (int i = 0; i < padded_taps; i += 8) {
+			int16x8_t const k = vld1q_s16(c + i);
+			int16x8_t const vl = vld1q_s16(l + i);
+			int16x8_t const vr = vld1q_s16(r + i);
+			suml = vmlal_s16(suml, vget_low_s16(vl), vget_low_s16(k));
+			suml = vmlal_s16(suml, vget_high_s16(vl), vget_high_s16(k));
+			sumr = vmlal_s16(sumr, vget_low_s16(vr), vget_low_s16(k));
+			sumr = vmlal_s16(sumr, vget_high_s16(vr), vget_high_s16(k));
+		}
+
+		int32x2_t const sums = vpadd_s32(vadd_s32(vget_low_s32(suml), vget_high_s32(suml)),
+		                                 vadd_s32(vget_low_s32(sumr), vget_high_s32(sumr)));
+		out[0] = scaleSum(vget_lane_s32(sums, 0));
+		out[1] = scaleSum(vget_lane_s32(sums, 1));
+		out += 2;
+		l += Decimator::FACTOR;
+		r += Decimator::FACTOR;
+	}
+}
+
+#endif
+
+} // anon ns
+
+Decimator::Decimator(std::size_t const maxInSamples, bool const simd)
+: bufSize_(maxInSamples + padded_taps + FACTOR)
+, buf_(bufSize_ * 2)
+, buffered_(0)
+, deinterleave_(deinterleaveGeneric)
+, filter_(filterGeneric)
+, kernelName_("scalar")
+{
+	if (!simd)
+		return;
+
+#ifdef DECIMATOR_AVX2
+	if (SDL_HasAVX2()) {
+		deinterleave_ = deinterleaveAvx2;
+		filter_ = filterAvx2;
+		kernelName_ = "AVX2";
+		return;
+	}
+#endif
+#if defined(DECIMATOR_SSE2)
+	deinterleave_ = deinterleaveSse2;
+	filter_ = filterSse2;
+	kernelName_ = "SSE2";
+#elif defined(DECIMATOR_NEON)
+	deinterleave_ = deinterleaveNeon;
+	filter_ = filterNeon;
+	kernelName_ = "NEON";
+#endif
+}
+
+std::size_t Decimator::decimate(Sint16 *const out, Sint16 const *const in,
+                                std::size_t const inSamples)
+{
+	Sint16 *const l = buf_;
+	Sint16 *const r = buf_ + bufSize_;
+	deinterleave_(l + buffered_, r + buffered_, in, inSamples);
+
+	std::size_t const avail = buffered_ + inSamples;
+	std::size_t const outSamples = avail >= padded_taps
+	                             ? (avail - padded_taps) / FACTOR + 1
+	                             : 0;
+	filter_(out, l, r, outSamples, coefs.values);
+
+	// Keep what the next output sample starts with
+	std::size_t const used = outSamples * FACTOR;
+	buffered_ = avail - used;
+	std::memmove(l, l + used, buffered_ * sizeof *l);
+	std::memmove(r, r + used, buffered_ * sizeof *r);
+	return outSamples;
+}
@@ -0,0 +1,45 @@
+#ifndef DECIMATOR_H_
+#define DECIMATOR_H_
+
+#include <common/array.h>
+#include <SDL.h>
+#include <cstddef>
+
+// Decimates the core's 2 MHz stereo output by 16 ahead of the resampler, so
+// the resampler's FIR stages run on a sixteenth of the samples. The filter
+// is a third order CIC response (three cascaded 16 sample moving sums)
+// applied as an FIR with integer coefficients: it has nulls where aliases
+// would land in the audible band after decimation and needs no floating
+// point. SSE2/AVX2 or NEON kernels are picked at runtime and give exactly
+// the same output as the scalar one.
+class Decimator {
+public:
+	enum { FACTOR = 16 };
+
+	// With simd false, always uses the scalar kernel
+	explicit Decimator(std::size_t maxInSamples, bool simd = true);
+
+	static std::size_t maxOut(std::size_t inSamples) { return inSamples / FACTOR + 1; }
+
+	// Decimates stereo samples into out, returning the number of samples
+	// written. Input that does not make up a whole output sample is kept
+	// for the next call.
+	std::size_t decimate(Sint16 *out, Sint16 const *in, std::size_t inSamples);
+
+	char const * kernelName() const { return kernelName_; }
+
+private:
+	typedef void (*Deinterleaver)(Sint16 *l, Sint16 *r, Sint16 const *in, std::size_t samples);
+	typedef void (*Filter)(Sint16 *out, Sint16 const *l, Sint16 const *r,
+	                       std::size_t outSamples, Sint16 const *coefs);
+
+	// Left channel followed by right channel, bufSize_ samples each
+	std::size_t const bufSize_;
+	Array<Sint16> const buf_;
+	std::size_t buffered_;
+	Deinterleaver deinterleave_;
+	Filter filter_;
+	char const *kernelName_;
+};
+
+#endif
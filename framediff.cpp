@@ -0,0 +1,41 @@
+#include "framediff.h"
+#include <algorithm>
+#include <cstring>
+
+FrameDiff::FrameDiff(int const width, int const height)
+: width_(width)
+, height_(height)
+, prev_(std::size_t(width) * height)
+, valid_(false)
+{
+}
+
+unsigned long FrameDiff::update(gambatte::uint_least32_t const *const frame,
+                                std::ptrdiff_t const pitch)
+{
+	std::size_t const rowBytes = width_ * sizeof *frame;
+	unsigned long dirty = 0;
+
+	for (int band = 0; band < bands(); ++band) {
+		int const y0 = band * band_rows;
+		int const y1 = std::min(y0 + band_rows, height_);
+
+		// memcmp is vectorized by the C library; bail out on the first
+		// differing row and refresh the whole band.
+		int y = y0;
+		while (valid_ && y < y1
+		       && std::memcmp(frame + y * pitch, prev_ + y * width_, rowBytes) == 0) {
+			++y;
+		}
+
+		if (y == y1)
+			continue;
+
+		dirty |= 1ul << band;
+		for (y = y0; y < y1; ++y)
+			std::memcpy(prev_ + y * width_, frame + y * pitch, rowBytes);
+	}
+
+	valid_ = true;
+	return dirty;
+}
@@ -0,0 +1,30 @@
+#ifndef FRAME_DIFF_H_
+#define FRAME_DIFF_H_
+
+#include "gbint.h"
+#include <common/array.h>
+#include <cstddef>
+
+// Finds which horizontal bands of a frame changed since the previous frame.
+// Keeps its own copy of the last frame, updated one changed band at a time.
+class FrameDiff {
+public:
+	enum { band_rows = 8 };
+
+	// height must not exceed band_rows * 32.
+	FrameDiff(int width, int height);
+
+	int bands() const { return (height_ + band_rows - 1) / band_rows; }
+
+	// Returns a mask with bit n set if rows [n * band_rows, (n + 1) * band_rows)
+	// differ from the previous frame. The first frame is reported as all changed.
+	unsigned long update(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch);
+
+private:
+	int const width_;
+	int const height_;
+	Array<gambatte::uint_least32_t> const prev_;
+	bool valid_;
+};
+
+#endif
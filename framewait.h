@@ -7,9 +7,12 @@ class FrameWait {
 public:
 	FrameWait() : last_() {}
 
-	void waitForNextFrameTime(usec_t frametime) {
-		last_ += asleep_.sleepUntil(last_, frametime);
+	// Returns how late the wait ended relative to the target frame time.
+	usec_t waitForNextFrameTime(usec_t frametime) {
+		usec_t const late = asleep_.sleepUntil(last_, frametime);
+		last_ += late;
 		last_ += frametime;
+		return late;
 	}
 
 private:
@@ -0,0 +1,24 @@
+#ifndef GB_FRAME_H_
+#define GB_FRAME_H_
+
+#include "usec.h"
+#include <cstddef>
+
+// Frame and audio sizes of the emulated Game Boy, as the main loop and the
+// headless modes run it.
+
+// 160x144 Game Boy resolution
+static int const gb_screen_width = 160;
+static int const gb_screen_height = 144;
+
+// The emulator's audio comes at 2097152 Hz, 35112 samples a frame
+static long const gb_sample_rate = 2097152;
+static std::size_t const gb_samples_per_frame = 35112;
+
+// Most samples runFor produces beyond the number asked for
+static std::size_t const gambatte_max_overproduction = 2064;
+
+// Length of a Game Boy frame: 70224 cycles at 4194304 Hz
+static usec_t const gb_frame_usecs = 16743;
+
+#endif
@@ -1,20 +1,126 @@
 #include "input.h"
+#include "latency.h"
 #include <SDL.h>
 #include <stdio.h>
 
 #define MAX_CONTROLLERS 4
 
-SDL_GameController *game_controllers[MAX_CONTROLLERS];
+// An open game controller and what is held on it: SDL controller buttons as
+// a bitmask indexed by SDL_GameControllerButton, and Game Boy buttons that
+// sticks and triggers stand in for
+typedef struct controller_t {
+  SDL_GameController *controller;
+  SDL_JoystickID id;
+  unsigned held;
+  unsigned axes;
+} controller_t;
+
+static controller_t controllers[MAX_CONTROLLERS];
+static int num_controllers = 0;
+
+// Game Boy buttons held on the keyboard, packed like the emulator wants them
+static unsigned keyboard_buttons = 0;
+static SDL_atomic_t packed_input_state;
+
+// Fast forward is active while a hotkey is held or after it is toggled on
+static bool fast_forward_key_held = false;
+static bool fast_forward_toggled = false;
+static SDL_atomic_t fast_forward;
+
+// Rewinding goes on while a hotkey is held
+static bool rewind_key_held = false;
+static SDL_atomic_t rewind_held;
+
+// Save state slot chosen with the number keys, and the last save state
+// action for the emulation thread to carry out (action | slot << 4)
+static int state_slot = 1;
+static SDL_atomic_t state_request;
+
+// Set once the user asks to quit
+static SDL_atomic_t quit;
+
+// Controller buttons for each Game Boy button, in input_buttons_t order
+static const SDL_GameControllerButton button_mappings[INPUT_MAX] = {
+    SDL_CONTROLLER_BUTTON_A,          SDL_CONTROLLER_BUTTON_B,
+    SDL_CONTROLLER_BUTTON_BACK,       SDL_CONTROLLER_BUTTON_START,
+    SDL_CONTROLLER_BUTTON_DPAD_RIGHT, SDL_CONTROLLER_BUTTON_DPAD_LEFT,
+    SDL_CONTROLLER_BUTTON_DPAD_UP,    SDL_CONTROLLER_BUTTON_DPAD_DOWN};
+
+static unsigned set_bit(unsigned mask, int bit, bool state) {
+  return state ? mask | 1u << bit : mask & ~(1u << bit);
+}
+
+static bool held(const controller_t *c, SDL_GameControllerButton button) {
+  return c->held >> button & 1;
+}
 
-static bool input_state[INPUT_MAX];
-static int num_joysticks = 0;
+// Updates the Game Boy buttons an analog control stands in for. Only a stick
+// or trigger pushed all the way counts.
+static void handle_axis(controller_t *c, int axis, int value) {
+  switch (axis) {
+  case SDL_CONTROLLER_AXIS_LEFTX:
+    c->axes = set_bit(c->axes, INPUT_LEFT, value < -32766);
+    c->axes = set_bit(c->axes, INPUT_RIGHT, value > 32766);
+    break;
+  case SDL_CONTROLLER_AXIS_LEFTY:
+    c->axes = set_bit(c->axes, INPUT_UP, value < -32766);
+    c->axes = set_bit(c->axes, INPUT_DOWN, value > 32766);
+    break;
+  case SDL_CONTROLLER_AXIS_TRIGGERLEFT:
+    c->axes = set_bit(c->axes, INPUT_SELECT, value > 32766);
+    break;
+  case SDL_CONTROLLER_AXIS_TRIGGERRIGHT:
+    c->axes = set_bit(c->axes, INPUT_START, value > 32766);
+    break;
+  }
+}
+
+static controller_t *find_controller(SDL_JoystickID id) {
+  for (int i = 0; i < num_controllers; i++) {
+    if (controllers[i].id == id)
+      return &controllers[i];
+  }
+  return NULL;
+}
+
+// Opens the controller at a device index unless it is open already, and
+// reads what is held on it. Later changes arrive as events.
+static void open_controller(int device_index) {
+  if (num_controllers >= MAX_CONTROLLERS ||
+      !SDL_IsGameController(device_index) ||
+      find_controller(SDL_JoystickGetDeviceInstanceID(device_index)))
+    return;
+
+  SDL_GameController *gc = SDL_GameControllerOpen(device_index);
+  if (gc == NULL)
+    return;
+
+  controller_t *c = &controllers[num_controllers++];
+  c->controller = gc;
+  c->id = SDL_JoystickInstanceID(SDL_GameControllerGetJoystick(gc));
+  c->held = 0;
+  c->axes = 0;
+  for (int b = 0; b < SDL_CONTROLLER_BUTTON_MAX; b++)
+    c->held = set_bit(c->held, b, SDL_GameControllerGetButton(
+                                      gc, (SDL_GameControllerButton)b));
+  for (int a = 0; a < SDL_CONTROLLER_AXIS_MAX; a++)
+    handle_axis(c, a, SDL_GameControllerGetAxis(gc, (SDL_GameControllerAxis)a));
+
+  SDL_Log("Controller %d: %s", num_controllers, SDL_GameControllerName(gc));
+}
+
+static void close_controller(SDL_JoystickID id) {
+  controller_t *c = find_controller(id);
+  if (c == NULL)
+    return;
+
+  SDL_GameControllerClose(c->controller);
+  *c = controllers[--num_controllers];
+}
 
 // Opens available game controllers and returns the amount of opened controllers
 int initialize_game_controllers() {
 
-  num_joysticks = SDL_NumJoysticks();
-  int controller_index = 0;
-
   SDL_Log("Looking for game controllers\n");
   SDL_Delay(
       10); // Some controllers like XBone wired need a little while to get ready
@@ -44,187 +150,243 @@ int initialize_game_controllers() {
                  "Unable to open game controller database file.");
   }
 
-  // Open all available game controllers
-  for (int i = 0; i < num_joysticks; i++) {
-    if (!SDL_IsGameController(i))
-      continue;
-    if (controller_index >= MAX_CONTROLLERS)
-      break;
-    game_controllers[controller_index] = SDL_GameControllerOpen(i);
-    SDL_Log("Controller %d: %s", controller_index + 1,
-            SDL_GameControllerName(game_controllers[controller_index]));
-    controller_index++;
-  }
+  // Open all available game controllers. SDL also reports them as added
+  // once events are handled, which finds them open already.
+  int const num_joysticks = SDL_NumJoysticks();
+  for (int i = 0; i < num_joysticks; i++)
+    open_controller(i);
 
-  return controller_index;
+  return num_controllers;
 }
 
 // Closes all open game controllers
 void close_game_controllers() {
 
-  for (int i = 0; i < MAX_CONTROLLERS; i++) {
-    if (game_controllers[i])
-      SDL_GameControllerClose(game_controllers[i]);
-  }
+  while (num_controllers > 0)
+    close_controller(controllers[0].id);
 }
 
 // Handles keyboard keys
 static void handle_normal_keys(SDL_Event *event, bool state) {
   switch (event->key.keysym.sym) {
   case SDLK_UP:
-    input_state[INPUT_UP] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_UP, state);
     break;
   case SDLK_LEFT:
-    input_state[INPUT_LEFT] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_LEFT, state);
     break;
   case SDLK_RIGHT:
-    input_state[INPUT_RIGHT] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_RIGHT, state);
     break;
   case SDLK_DOWN:
-    input_state[INPUT_DOWN] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_DOWN, state);
     break;
   case SDLK_z:
   case SDLK_LSHIFT:
-    input_state[INPUT_SELECT] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_SELECT, state);
     break;
   case SDLK_x:
   case SDLK_SPACE:
-    input_state[INPUT_START] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_START, state);
     break;
   case SDLK_s:
-    input_state[INPUT_B] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_B, state);
     break;
   case SDLK_d:
-    input_state[INPUT_A] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_A, state);
     break;
   case SDLK_DELETE:
-    input_state[INPUT_A] = state;
-    input_state[INPUT_B] = state;
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_A, state);
+    keyboard_buttons = set_bit(keyboard_buttons, INPUT_B, state);
+    break;
+  case SDLK_TAB:
+    fast_forward_key_held = state;
+    break;
+  case SDLK_t:
+    if (state && !event->key.repeat)
+      fast_forward_toggled = !fast_forward_toggled;
+    break;
+  case SDLK_BACKSPACE:
+    rewind_key_held = state;
+    break;
+  case SDLK_0:
+  case SDLK_1:
+  case SDLK_2:
+  case SDLK_3:
+  case SDLK_4:
+  case SDLK_5:
+  case SDLK_6:
+  case SDLK_7:
+  case SDLK_8:
+  case SDLK_9:
+    if (state && !event->key.repeat) {
+      state_slot = event->key.keysym.sym - SDLK_0;
+      SDL_AtomicSet(&state_request, STATE_SELECT | state_slot << 4);
+    }
+    break;
+  case SDLK_F5:
+    if (state && !event->key.repeat)
+      SDL_AtomicSet(&state_request, STATE_SAVE | state_slot << 4);
+    break;
+  case SDLK_F8:
+    if (state && !event->key.repeat)
+      SDL_AtomicSet(&state_request, STATE_LOAD | state_slot << 4);
     break;
   case SDLK_ESCAPE:
-    exit(0);
+    SDL_AtomicSet(&quit, 1);
     break;
   }
 }
 
-// Check whether a button is pressed on a gamepad and return 1 if pressed.
-static int get_game_controller_button(SDL_GameController *controller,
-                                      int button) {
-
-  const SDL_GameControllerButton button_mappings[8] = {
-      SDL_CONTROLLER_BUTTON_A,          SDL_CONTROLLER_BUTTON_B,
-      SDL_CONTROLLER_BUTTON_BACK,       SDL_CONTROLLER_BUTTON_START,
-      SDL_CONTROLLER_BUTTON_DPAD_RIGHT, SDL_CONTROLLER_BUTTON_DPAD_LEFT,
-      SDL_CONTROLLER_BUTTON_DPAD_UP,    SDL_CONTROLLER_BUTTON_DPAD_DOWN};
-
-  // Check digital buttons
-  if (SDL_GameControllerGetButton(controller, button_mappings[button])) {
-    return 1;
-  } else {
-    // If digital button isn't pressed, check the corresponding analog control
-    switch (button) {
-    case INPUT_UP:
-      return SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY) <
-             -32766;
-    case INPUT_DOWN:
-      return SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTY) >
-             32766;
-    case INPUT_LEFT:
-      return SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX) <
-             -32766;
-    case INPUT_RIGHT:
-      return SDL_GameControllerGetAxis(controller, SDL_CONTROLLER_AXIS_LEFTX) >
-             32766;
-    case INPUT_SELECT:
-      return SDL_GameControllerGetAxis(controller,
-                                       SDL_CONTROLLER_AXIS_TRIGGERLEFT) > 32766;
-    case INPUT_START:
-      return SDL_GameControllerGetAxis(
-                 controller, SDL_CONTROLLER_AXIS_TRIGGERRIGHT) > 32766;
-    default:
-      return 0;
-    }
-  }
-  return 0;
+// Handles a controller button. Guide+Back+Start together quits. Returns
+// whether the buttons held changed.
+static bool handle_controller_button(SDL_ControllerButtonEvent *event,
+                                     bool state) {
+  controller_t *c = find_controller(event->which);
+  if (c == NULL)
+    return false;
+
+  unsigned const before = c->held;
+  c->held = set_bit(c->held, event->button, state);
+  if (held(c, SDL_CONTROLLER_BUTTON_GUIDE) &&
+      held(c, SDL_CONTROLLER_BUTTON_BACK) &&
+      held(c, SDL_CONTROLLER_BUTTON_START))
+    SDL_AtomicSet(&quit, 1);
+
+  return c->held != before;
 }
 
-// Handle game controllers, check all buttons and analog axis on every cycle
-static void handle_game_controller_buttons() {
-
-  // Cycle through every active game controller
-  for (int gc = 0; gc < num_joysticks; gc++) {
-    // Cycle through all Gameboy buttons
-    for (int button = 0; button < (input_buttons_t)INPUT_MAX; button++) {
-      // If the button is active, add the keycode to the active key array
-      if (get_game_controller_button(game_controllers[gc], button)) {
-        input_state[button] = true;
-      } else {
-        input_state[button] = false;
-      }
+// Publishes the state built up from events for get_input and the other
+// queries, with the buttons held on all controllers and the keyboard
+// combined. event_usecs is when the first event that changed them came in.
+static void publish_input(usec_t event_usecs) {
+  unsigned buttons = keyboard_buttons;
+  bool fast_forward_pad_held = false;
+  bool rewind_pad_held = false;
+
+  for (int i = 0; i < num_controllers; i++) {
+    controller_t const *c = &controllers[i];
+    buttons |= c->axes;
+    for (int button = 0; button < INPUT_MAX; button++) {
+      if (held(c, button_mappings[button]))
+        buttons |= 1u << button;
     }
 
-    // Magic combo for quitting program: Guide+Back+Start
-    if (SDL_GameControllerGetButton(game_controllers[gc],
-                                    SDL_CONTROLLER_BUTTON_GUIDE) &&
-        SDL_GameControllerGetButton(game_controllers[gc],
-                                    SDL_CONTROLLER_BUTTON_BACK) &&
-        SDL_GameControllerGetButton(game_controllers[gc],
-                                    SDL_CONTROLLER_BUTTON_START)) {
-      exit(0);
-    }
+    // Hold right shoulder to fast forward, left shoulder to rewind
+    fast_forward_pad_held |= held(c, SDL_CONTROLLER_BUTTON_RIGHTSHOULDER);
+    rewind_pad_held |= held(c, SDL_CONTROLLER_BUTTON_LEFTSHOULDER);
   }
+
+  if (latency_active() &&
+      buttons != (unsigned)SDL_AtomicGet(&packed_input_state))
+    latency_input(event_usecs);
+
+  SDL_AtomicSet(&packed_input_state, buttons);
+  SDL_AtomicSet(&fast_forward, fast_forward_key_held || fast_forward_pad_held ||
+                                   fast_forward_toggled);
+  SDL_AtomicSet(&rewind_held, rewind_key_held || rewind_pad_held);
 }
 
-// Handles SDL input events
+// Handles all pending SDL events, updating the input state they change.
+// Must be called from the main thread, about once a frame.
 void handle_sdl_events() {
 
   SDL_Event event;
+  usec_t const now = getusecs();
+  Uint32 const ticks = SDL_GetTicks();
+  usec_t event_usecs = now;
+  bool timed = false;
 
-  // Read joysticks
-  handle_game_controller_buttons();
+  while (SDL_PollEvent(&event)) {
+    // Whether the event changed the buttons held, as opposed to key repeats,
+    // axis jitter, window events and the like
+    bool changed = false;
 
-  SDL_PollEvent(&event);
+    switch (event.type) {
 
-  switch (event.type) {
+    case SDL_CONTROLLERDEVICEADDED:
+      open_controller(event.cdevice.which);
+      break;
 
-  // Reinitialize game controllers on controller add/remove/remap
-  case SDL_CONTROLLERDEVICEADDED:
-  case SDL_CONTROLLERDEVICEREMOVED:
-    initialize_game_controllers();
-    break;
+    case SDL_CONTROLLERDEVICEREMOVED:
+      close_controller(event.cdevice.which);
+      break;
 
-  // Keyboard events
-  case SDL_KEYDOWN:
-    handle_normal_keys(&event, true);
-    break;
+    case SDL_CONTROLLERBUTTONDOWN:
+      changed = handle_controller_button(&event.cbutton, true);
+      break;
 
-  case SDL_KEYUP:
-    handle_normal_keys(&event, false);
-    break;
+    case SDL_CONTROLLERBUTTONUP:
+      changed = handle_controller_button(&event.cbutton, false);
+      break;
 
-  // Window close, OS shutdown request etc
-  case SDL_QUIT:
-    exit(0);
-    break;
+    case SDL_CONTROLLERAXISMOTION: {
+      controller_t *c = find_controller(event.caxis.which);
+      if (c != NULL) {
+        unsigned const before = c->axes;
+        handle_axis(c, event.caxis.axis, event.caxis.value);
+        changed = c->axes != before;
+      }
+      break;
+    }
 
-  default:
-    break;
+    // Keyboard events
+    case SDL_KEYDOWN:
+    case SDL_KEYUP: {
+      unsigned const before = keyboard_buttons;
+      handle_normal_keys(&event, event.type == SDL_KEYDOWN);
+      changed = keyboard_buttons != before;
+      break;
+    }
+
+    // Window close, OS shutdown request etc
+    case SDL_QUIT:
+      SDL_AtomicSet(&quit, 1);
+      break;
+
+    default:
+      break;
+    }
+
+    // Input latency is timed from the first change, using the millisecond
+    // tick events carry
+    if (changed && !timed) {
+      timed = true;
+      if (event.common.timestamp <= ticks)
+        event_usecs = now - (usec_t)(ticks - event.common.timestamp) * 1000;
+    }
   }
+
+  publish_input(event_usecs);
 }
 
-// Converts the input state array to something that gambatte-speedrun expects
-static unsigned int packedInputState(bool const inputState[],
-                                     std::size_t const len) {
-  unsigned is = 0;
-  for (std::size_t i = 0; i < len; ++i)
-    is |= inputState[i] << (i & 7);
+// Returns the controller state as of the last handle_sdl_events call without
+// touching SDL, so it is safe to call from any thread
+unsigned int get_input() {
+  if (latency_active())
+    latency_input_read();
 
-  return is;
+  return SDL_AtomicGet(&packed_input_state);
 }
 
-// Queries SDL event status and returns the current controller state
-unsigned int get_input() {
-  handle_sdl_events();
-  return packedInputState(input_state,
-                          sizeof input_state / sizeof input_state[0]);
-}
\ No newline at end of file
+// Returns whether the user asked to quit. Safe to call from any thread.
+int quit_requested() { return SDL_AtomicGet(&quit); }
+
+// Asks the main loop to quit. Only sets the flag, so it is safe to call from
+// a signal handler.
+void request_quit() { SDL_AtomicSet(&quit, 1); }
+
+// Returns whether the user wants to run faster than realtime. Safe to call
+// from any thread.
+int fast_forward_active() { return SDL_AtomicGet(&fast_forward); }
+
+// Returns whether the user wants to rewind. Safe to call from any thread.
+int rewind_active() { return SDL_AtomicGet(&rewind_held); }
+
+// Returns the last save state action requested since the previous call and
+// its slot. Safe to call from any thread.
+state_action_t take_state_request(int *slot) {
+  int const request = SDL_AtomicSet(&state_request, 0);
+  *slot = request >> 4;
+  return (state_action_t)(request & 15);
+}
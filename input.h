@@ -18,8 +18,21 @@ typedef enum input_buttons_t {
   INPUT_MAX
 } input_buttons_t;
 
+typedef enum state_action_t {
+  STATE_NONE,
+  STATE_SELECT,
+  STATE_SAVE,
+  STATE_LOAD
+} state_action_t;
+
 int initialize_game_controllers();
 void close_game_controllers();
+void handle_sdl_events();
 unsigned get_input();
+int quit_requested();
+void request_quit();
+int fast_forward_active();
+int rewind_active();
+state_action_t take_state_request(int *slot);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,103 @@
+#include "inputscript.h"
+#include "input.h"
+#include "SDL_log.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+static const char *const button_names[INPUT_MAX] = {
+    "A", "B", "SELECT", "START", "RIGHT", "LEFT", "UP", "DOWN"};
+
+// Parses buttons like "A+START". Returns -1 if a name is unknown.
+static int parse_buttons(char *text) {
+  if (strcmp(text, "-") == 0)
+    return 0;
+
+  int buttons = 0;
+  for (char *name = strtok(text, "+"); name != NULL; name = strtok(NULL, "+")) {
+    int button = 0;
+    while (button < INPUT_MAX && strcasecmp(name, button_names[button]) != 0)
+      button++;
+    if (button == INPUT_MAX)
+      return -1;
+
+    buttons |= 1 << button;
+  }
+
+  return buttons;
+}
+
+int input_script_load(input_script *script, const char *filename) {
+  memset(script, 0, sizeof *script);
+
+  FILE *file = fopen(filename, "r");
+  if (file == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_INPUT, "Cannot open input script %s",
+                 filename);
+    return -1;
+  }
+
+  std::size_t capacity = 0;
+  char line[256];
+  int line_number = 0;
+  while (fgets(line, sizeof line, file) != NULL) {
+    line_number++;
+    char *comment = strchr(line, '#');
+    if (comment != NULL)
+      *comment = '\0';
+
+    long frame = 0;
+    char buttons_text[128];
+    int const fields = sscanf(line, "%ld %127s", &frame, buttons_text);
+    if (fields <= 0)
+      continue;
+
+    int const buttons = fields == 2 ? parse_buttons(buttons_text) : -1;
+    if (buttons < 0 || frame < 0 ||
+        (script->count > 0 && frame <= script->events[script->count - 1].frame)) {
+      SDL_LogError(SDL_LOG_CATEGORY_INPUT, "%s:%d: invalid input script line",
+                   filename, line_number);
+      fclose(file);
+      input_script_free(script);
+      return -1;
+    }
+
+    if (script->count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      input_event *const events = (input_event *)realloc(
+          script->events, capacity * sizeof *script->events);
+      if (events == NULL) {
+        fclose(file);
+        input_script_free(script);
+        return -1;
+      }
+
+      script->events = events;
+    }
+
+    script->events[script->count].frame = frame;
+    script->events[script->count].buttons = buttons;
+    script->count++;
+  }
+
+  fclose(file);
+  return 0;
+}
+
+void input_script_free(input_script *script) {
+  free(script->events);
+  memset(script, 0, sizeof *script);
+}
+
+unsigned input_script_at(input_script *script, long frame) {
+  while (script->next < script->count &&
+         script->events[script->next].frame <= frame) {
+    script->buttons = script->events[script->next].buttons;
+    script->next++;
+  }
+
+  return script->buttons;
+}
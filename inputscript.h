@@ -0,0 +1,32 @@
+#ifndef INPUT_SCRIPT_H_
+#define INPUT_SCRIPT_H_
+
+#include <cstddef>
+
+// A scripted button sequence. Script files have one line per change:
+//
+//   <frame> <buttons>
+//
+// where frame counts video frames from the start and buttons are the ones
+// held from then on, joined with '+' (A, B, SELECT, START, RIGHT, LEFT, UP,
+// DOWN) or '-' for none. Frames must increase. '#' starts a comment.
+typedef struct input_event {
+  long frame;
+  unsigned buttons; // as expected by gambatte, see input_buttons_t
+} input_event;
+
+typedef struct input_script {
+  input_event *events;
+  std::size_t count;
+  std::size_t next;  // first event not reached yet
+  unsigned buttons;  // currently held
+} input_script;
+
+// Returns 0 on success. The script must be freed with input_script_free
+int input_script_load(input_script *script, const char *filename);
+void input_script_free(input_script *script);
+
+// Returns the buttons held at the given frame. Frames must not go backwards.
+unsigned input_script_at(input_script *script, long frame);
+
+#endif
@@ -0,0 +1,238 @@
+#include "latency.h"
+#include "framewait.h"
+#include "gbframe.h"
+#include "input.h"
+#include "runahead.h"
+
+#include <SDL.h>
+#include <algorithm>
+#include <common/array.h>
+#include <cstring>
+#include <stdio.h>
+
+#define LATENCY_MAX_SAMPLES 4096
+
+// A change goes through these stages. Each stage is left by one thread
+// only, which hands the change on by setting the next one.
+enum latency_stage {
+  STAGE_IDLE,    // nothing in flight, left by latency_input
+  STAGE_PENDING, // left by latency_input_read
+  STAGE_SEEN,    // left by latency_frame_done
+  STAGE_DONE     // left by latency_presented
+};
+
+typedef struct latency_sample {
+  usec_t input_to_read;
+  usec_t read_to_done;
+  usec_t done_to_upload;
+  usec_t upload_to_present;
+  usec_t total;
+} latency_sample;
+
+static bool active = false;
+static SDL_atomic_t stage;
+static usec_t input_usecs, read_usecs, done_usecs;
+static unsigned done_frame;
+
+// Written by the presenting thread only
+static latency_sample samples[LATENCY_MAX_SAMPLES];
+static SDL_atomic_t num_samples;
+
+void latency_enable() { active = true; }
+
+int latency_active() { return active; }
+
+int latency_samples() { return SDL_AtomicGet(&num_samples); }
+
+// The held buttons changed at when
+void latency_input(usec_t when) {
+  if (SDL_AtomicGet(&stage) != STAGE_IDLE)
+    return;
+
+  input_usecs = when;
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&stage, STAGE_PENDING);
+}
+
+// The emulated game read the joypad
+void latency_input_read() {
+  if (SDL_AtomicGet(&stage) != STAGE_PENDING)
+    return;
+
+  SDL_MemoryBarrierAcquire();
+  read_usecs = getusecs();
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&stage, STAGE_SEEN);
+}
+
+// The emulator finished a frame, after running ahead if it does
+void latency_frame_done(unsigned frame) {
+  if (SDL_AtomicGet(&stage) != STAGE_SEEN)
+    return;
+
+  SDL_MemoryBarrierAcquire();
+  done_frame = frame;
+  done_usecs = getusecs();
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&stage, STAGE_DONE);
+}
+
+// A frame was uploaded and presented. Any frame from the one the change was
+// seen in on shows it.
+void latency_presented(unsigned frame, usec_t uploaded, usec_t presented) {
+  if (SDL_AtomicGet(&stage) != STAGE_DONE)
+    return;
+
+  SDL_MemoryBarrierAcquire();
+  if ((int)(frame - done_frame) < 0)
+    return;
+
+  int const n = SDL_AtomicGet(&num_samples);
+  if (n < LATENCY_MAX_SAMPLES) {
+    latency_sample *s = &samples[n];
+    s->input_to_read = read_usecs - input_usecs;
+    s->read_to_done = done_usecs - read_usecs;
+    s->done_to_upload = uploaded - done_usecs;
+    s->upload_to_present = presented - uploaded;
+    s->total = presented - input_usecs;
+    SDL_AtomicSet(&num_samples, n + 1);
+  }
+
+  SDL_AtomicSet(&stage, STAGE_IDLE);
+}
+
+static bool total_less(const latency_sample &a, const latency_sample &b) {
+  return a.total < b.total;
+}
+
+static double ms(usec_t usecs) { return usecs / 1000.0; }
+
+void latency_report() {
+  int const n = SDL_AtomicGet(&num_samples);
+  if (n == 0) {
+    printf("No input latency measured. The rom has to read the joypad "
+           "while buttons change.\n");
+    return;
+  }
+
+  std::sort(samples, samples + n, total_less);
+
+  double sum[4] = {0};
+  for (int i = 0; i < n; i++) {
+    sum[0] += samples[i].input_to_read;
+    sum[1] += samples[i].read_to_done;
+    sum[2] += samples[i].done_to_upload;
+    sum[3] += samples[i].upload_to_present;
+  }
+
+  printf("Input to photon latency over %d changes, ms:\n", n);
+  printf("  min %.1f  median %.1f  95th percentile %.1f  max %.1f\n",
+         ms(samples[0].total), ms(samples[n / 2].total),
+         ms(samples[n * 95 / 100].total), ms(samples[n - 1].total));
+  printf("  mean: event to joypad read %.1f, read to frame done %.1f,\n"
+         "        frame done to upload %.1f, upload to present %.1f\n",
+         sum[0] / n / 1000, sum[1] / n / 1000, sum[2] / n / 1000,
+         sum[3] / n / 1000);
+
+  // Buckets of at least a millisecond, about 20 of them over the range
+  usec_t const lo = samples[0].total / 1000 * 1000;
+  usec_t const range = samples[n - 1].total - lo;
+  usec_t const width = std::max<usec_t>(1000, (range / 20 + 999) / 1000 * 1000);
+  int const buckets = range / width + 1;
+  int peak = 0;
+  for (int b = 0, i = 0; b < buckets; b++) {
+    int count = 0;
+    for (; i < n && samples[i].total < lo + (b + 1) * width; i++)
+      count++;
+    peak = std::max(peak, count);
+  }
+
+  for (int b = 0, i = 0; b < buckets; b++) {
+    int count = 0;
+    for (; i < n && samples[i].total < lo + (b + 1) * width; i++)
+      count++;
+
+    char bar[51];
+    int const len = count * 50 / peak;
+    std::memset(bar, '#', len);
+    bar[len] = '\0';
+    printf("  %5.0f-%-5.0f %5d %s\n", ms(lo + b * width),
+           ms(lo + (b + 1) * width), count, bar);
+  }
+}
+
+// Buttons handed to the emulator in the headless test. A change takes
+// effect at inject_at and is reported when the game first reads it.
+typedef struct synthetic_input {
+  unsigned buttons;
+  bool pending;
+  usec_t inject_at;
+} synthetic_input;
+
+static unsigned get_synthetic_input(void *p) {
+  synthetic_input *input = static_cast<synthetic_input *>(p);
+  if (input->pending && getusecs() >= input->inject_at) {
+    input->buttons ^= 1 << INPUT_A;
+    input->pending = false;
+    latency_input(input->inject_at);
+    latency_input_read();
+  }
+
+  return input->buttons;
+}
+
+int run_latency_test(gambatte::GB *gb, int presses, int run_ahead) {
+  Array<Uint32> const audioBuf(gb_samples_per_frame +
+                               gambatte_max_overproduction);
+  Array<uint_least32_t> const videoBuf(gb_screen_width * gb_screen_height);
+  Array<uint_least32_t> const textureBuf(videoBuf.size());
+  std::memset(videoBuf, 0, videoBuf.size() * sizeof *videoBuf);
+  RunAhead runAhead(run_ahead, audioBuf.size());
+  FrameWait frameWait;
+
+  synthetic_input input = {0, false, 0};
+  gb->setInputGetter(&get_synthetic_input, &input);
+  latency_enable();
+
+  // Changes are spaced a random number of frames apart and land at a random
+  // point of a frame, so they do not line up with the game's joypad reads
+  Uint32 rand = 1;
+  long const max_frames = presses * 120L + 600;
+  long next_frame = -1;
+  int injected = 0;
+  unsigned frame = 0;
+
+  printf("Measuring input latency over %d changes...\n", presses);
+
+  while (latency_samples() < presses && (long)frame < max_frames) {
+    if (!input.pending && latency_samples() == injected) {
+      rand = rand * 1664525 + 1013904223;
+      if (next_frame < 0) {
+        next_frame = frame + 5 + (rand >> 16) % 16;
+      } else if ((long)frame >= next_frame) {
+        input.inject_at = getusecs() + (rand >> 8) % gb_frame_usecs;
+        input.pending = true;
+        injected++;
+        next_frame = -1;
+      }
+    }
+
+    std::size_t samples = gb_samples_per_frame;
+    if (gb->runFor(videoBuf, gb_screen_width, audioBuf, samples) < 0)
+      continue;
+
+    if (run_ahead > 0 && !runAhead.run(*gb, videoBuf, gb_screen_width)) {
+      printf("Save states failed, cannot run ahead\n");
+      return 1;
+    }
+
+    latency_frame_done(++frame);
+    std::memcpy(textureBuf, videoBuf, videoBuf.size() * sizeof *videoBuf);
+    usec_t const uploaded = getusecs();
+    frameWait.waitForNextFrameTime(gb_frame_usecs);
+    latency_presented(frame, uploaded, getusecs());
+  }
+
+  latency_report();
+  return latency_samples() < presses;
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include "gambatte.h"
+#include "usec.h"
+
+// Input-to-photon latency. A change in the held buttons is followed from the
+// input event through the first time the emulated game reads the joypad and
+// sees it, to the end of the frame that read happens in and to the upload
+// and present of the first frame shown from then on. One change is followed
+// at a time; changes made while one is in flight are not measured.
+//
+// latency_input is called by the thread handling input, latency_input_read
+// and latency_frame_done by the emulation thread and latency_presented by
+// the thread presenting frames. Frames are numbered by the emulation loop.
+
+void latency_enable();
+int latency_active();
+int latency_samples();
+void latency_input(usec_t when);
+void latency_input_read();
+void latency_frame_done(unsigned frame);
+void latency_presented(unsigned frame, usec_t uploaded, usec_t presented);
+
+// Prints a histogram of the latencies measured so far and where the time
+// went
+void latency_report();
+
+// Measures latency without a window, pressing and releasing A at random
+// times until presses changes were measured. Frames are paced to realtime
+// and presenting is a copy standing in for the texture upload.
+int run_latency_test(gambatte::GB *gb, int presses, int run_ahead);
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef LITTLE_ENDIAN_H_
+#define LITTLE_ENDIAN_H_
+
+// Little endian integers in file headers
+
+inline void put16(unsigned char *p, unsigned long n) {
+	p[0] = n & 0xff;
+	p[1] = n >> 8 & 0xff;
+}
+
+inline void put32(unsigned char *p, unsigned long n) {
+	for (int i = 0; i < 4; ++i)
+		p[i] = n >> i * 8 & 0xff;
+}
+
+inline unsigned long get32(unsigned char const *p) {
+	return p[0] | p[1] << 8 | static_cast<unsigned long>(p[2]) << 16
+	     | static_cast<unsigned long>(p[3]) << 24;
+}
+
+#endif
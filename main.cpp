@@ -1,13 +1,34 @@
 #include "audioout.h"
+#include "audioring.h"
 #include "audiosink.h"
+#include "bench.h"
+#include "bootcache.h"
+#include "capture.h"
 #include "framewait.h"
 #include "gambatte.h"
+#include "gbframe.h"
 #include "gbint.h"
 #include "input.h"
+#include "inputscript.h"
+#include "latency.h"
+#include "mappedfile.h"
 #include "resample/resamplerinfo.h"
+#include "render.h"
+#include "resamplerbench.h"
+#include "rewind.h"
+#include "runahead.h"
+#include "safefile.h"
 #include "skipsched.h"
+#include "sramsaver.h"
+#include "stateslots.h"
+#include "telemetry.h"
 #include "usec.h"
 #include "midi.h"
+#include "movie.h"
+#include "options.h"
+#include "triplebuffer.h"
+#include "videoout.h"
+#include "videosink.h"
 
 #include <SDL.h>
 #include <cstddef>
@@ -15,48 +36,308 @@
 #include <porttime.h>
 #include <signal.h>
 #include <stdlib.h>
+#include <string>
 #include <unistd.h>
 
 using namespace gambatte;
 
 SDL_Window *win;
 SDL_Renderer *rend;
-SDL_Texture *maintexture;
-
-// 160x144 Gameboy resolution
-const int texture_width = 160;
-const int texture_height = 144;
-
-static uint32_t *videoBuf = new uint32_t[texture_width * texture_height];
 
 static gambatte::GB gb_;
 
-static std::size_t const gb_samples_per_frame = 35112;
-static std::size_t const gambatte_max_overproduction = 2064;
-
-static int render_sdl() {
-  SDL_SetRenderTarget(rend, NULL);
-  SDL_SetRenderDrawColor(rend, 0, 0, 0, 0);
-  SDL_RenderClear(rend);
-  SDL_RenderCopy(rend, maintexture, NULL, NULL);
-  SDL_RenderPresent(rend);
-  return 0;
-}
+// State shared between the main thread and the emulation thread
+struct emulation {
+  AudioOut *aout;
+  long sample_rate;
+  VideoSink *video_out; // frames are presented here when not threaded
+  TripleBuffer<uint_least32_t> *frames; // otherwise they are published here
+  SDL_sem *frame_ready;
+  Capture *capture; // receives every frame if set, audio comes through aout
+  int ff_speed;     // fast forward speed cap, 0 for unlimited
+  int run_ahead;    // frames to run ahead, 0 to disable
+  bool dynamic_rate; // paced by the timer, audio adapts its rate
+  Rewind *rewind;   // state history to rewind through if set
+  StateSlots *slots;
+  SramSaver *sram; // keeps battery RAM on disk if set
+  BootCache *boot; // caches the state after the boot ROM if set
+  input_movie *movie; // recorded or replayed input if set
+};
+
+// While fast forwarding, frames are shown at most this often
+static usec_t const ff_present_interval = 1000000 / 60;
+
+static SDL_atomic_t emulation_running;
+static SDL_Thread *emulation_thread;
+static SDL_atomic_t last_present_usecs; // set by the main thread if threaded
+static SDL_atomic_t published_frame; // number of the newest published frame
+static Capture *capture;
+static StateSlots *state_slots;
+static SramSaver *sram_saver;
+static BootCache *boot_cache;
+static input_movie movie;
+
+// Battery RAM is copied for writing about once a second
+static int const sram_interval_frames = 60;
 
 void destroy_sdl() {
   midi_destroy();
   close_game_controllers();
   SDL_Log("Shutting down");
-  SDL_PauseAudio(1);
-  SDL_CloseAudio();
-  SDL_DestroyTexture(maintexture);
   SDL_DestroyRenderer(rend);
   SDL_DestroyWindow(win);
   SDL_Quit();
 }
 
-// Handles CTRL+C / SIGINT
-void int_handler(int dummy) { exit(1); }
+// Handles CTRL+C / SIGINT. The exit handlers lock mutexes and join threads,
+// which is not safe from a signal handler, so this only asks the main loop
+// to quit and shutdown runs on the ordinary path.
+void int_handler(int dummy) { request_quit(); }
+
+// Copies a frame rendered without padding into a buffer with the given pitch
+static void copy_frame(uint_least32_t *dst, std::ptrdiff_t pitch,
+                       uint_least32_t const *src) {
+  for (int y = 0; y < gb_screen_height; y++)
+    std::memcpy(dst + y * pitch, src + y * gb_screen_width,
+                gb_screen_width * sizeof *dst);
+}
+
+// Runs the emulator, paced by the audio output. Finished frames are either
+// presented right away or, when running threaded, published for the main
+// thread to present.
+static int emulate(void *data) {
+  emulation *const emu = static_cast<emulation *>(data);
+
+  std::size_t bufsamples = 0;
+  AudioRing audioRing(gb_samples_per_frame + gambatte_max_overproduction);
+  FrameWait frameWait;
+  SkipSched skipSched;
+  bool audioOutBufLow = false;
+  usec_t lastBlit = 0;
+  unsigned frame = 0;
+  bool rewindRefused = false;
+
+  // With run-ahead, the canonical timeline renders into a frame of its own
+  // and the displayed frame comes from running ahead
+  scoped_ptr<RunAhead> runAhead(
+      emu->run_ahead > 0 ? new RunAhead(emu->run_ahead, audioRing.capacity()) : 0);
+  Array<uint_least32_t> const canonicalFrame(
+      runAhead.get() ? gb_screen_width * gb_screen_height : 0);
+
+  while (SDL_AtomicGet(&emulation_running) && !quit_requested()) {
+    // Unless threaded, this is the main thread, which handles input once a
+    // frame before running it
+    if (!emu->frames)
+      handle_sdl_events();
+
+    uint_least32_t *const videoBuf =
+        emu->frames ? emu->frames->back() : emu->video_out->frameBuf();
+    std::ptrdiff_t const pitch =
+        emu->frames ? gb_screen_width : emu->video_out->pitch();
+
+    telemetry_record rec = {};
+    usec_t const runStart = getusecs();
+
+    bool const runningAhead = runAhead.get() != NULL;
+    uint_least32_t *const runBuf = runningAhead ? canonicalFrame : videoBuf;
+    std::ptrdiff_t const runPitch = runningAhead ? gb_screen_width : pitch;
+
+    Uint32 *const audioBuf = audioRing.front();
+    std::size_t runsamples = gb_samples_per_frame - bufsamples;
+    std::ptrdiff_t const vidFrameDoneSampleCnt =
+        emu->boot ? emu->boot->runFor(gb_, runBuf, runPitch,
+                                      audioBuf + bufsamples, runsamples)
+                  : gb_.runFor(runBuf, runPitch, audioBuf + bufsamples,
+                               runsamples);
+    rec.runfor_usecs = getusecs() - runStart;
+
+    // When fast forwarding, audio does not pace emulation and only enough
+    // frames are shown to keep the display moving
+    bool const ff = fast_forward_active();
+    bool const blit =
+        vidFrameDoneSampleCnt >= 0 &&
+        (ff ? getusecs() - lastBlit >= ff_present_interval
+            : !skipSched.skipNext(audioOutBufLow));
+    if (blit)
+      lastBlit = getusecs();
+
+    // Frames that are not shown are not worth running ahead for
+    if (runningAhead && blit) {
+      usec_t const aheadStart = getusecs();
+      if (emu->movie)
+        emu->movie->speculating = true;
+      bool const ranAhead = runAhead->run(gb_, videoBuf, pitch);
+      if (emu->movie)
+        emu->movie->speculating = false;
+      if (!ranAhead) {
+        SDL_LogError(SDL_LOG_CATEGORY_SYSTEM,
+                     "Save states failed, disabling run-ahead");
+        runAhead.reset();
+        copy_frame(videoBuf, pitch, canonicalFrame);
+      }
+      rec.run_ahead_usecs = getusecs() - aheadStart;
+    } else if (runningAhead && vidFrameDoneSampleCnt >= 0) {
+      copy_frame(videoBuf, pitch, canonicalFrame);
+    }
+
+    if (vidFrameDoneSampleCnt >= 0)
+      latency_frame_done(++frame);
+
+    // While rewinding, each frame shows one step further back in the history
+    // and is heard as silence. A movie only holds input, so jumping around in
+    // time while one is recorded or replayed would desync it.
+    bool const rewindHeld = emu->rewind && rewind_active();
+    if (rewindHeld && emu->movie && !rewindRefused)
+      SDL_Log("Not rewinding while a movie is recorded or replayed");
+    rewindRefused = rewindHeld && emu->movie;
+    bool const rewinding = rewindHeld && !emu->movie;
+    if (emu->rewind && vidFrameDoneSampleCnt >= 0) {
+      if (rewinding)
+        emu->rewind->stepBack(gb_);
+      else
+        emu->rewind->frame(gb_);
+    }
+
+    if (vidFrameDoneSampleCnt >= 0) {
+      int slot;
+      switch (take_state_request(&slot)) {
+      case STATE_SELECT:
+        emu->slots->prefetch(slot);
+        break;
+      case STATE_SAVE:
+        emu->slots->save(gb_, slot);
+        break;
+      case STATE_LOAD:
+        if (emu->movie)
+          SDL_Log("Not loading state %d while a movie is recorded or "
+                  "replayed",
+                  slot);
+        else
+          emu->slots->load(gb_, slot);
+        break;
+      case STATE_NONE:
+        break;
+      }
+    }
+    emu->slots->update(gb_);
+
+    if (emu->sram && vidFrameDoneSampleCnt >= 0)
+      emu->sram->frame(gb_);
+
+    if (emu->boot && vidFrameDoneSampleCnt >= 0 && !emu->boot->frame())
+      emu->boot = NULL;
+
+    std::size_t const outsamples = vidFrameDoneSampleCnt >= 0
+                                       ? bufsamples + vidFrameDoneSampleCnt
+                                       : bufsamples + runsamples;
+    bufsamples += runsamples;
+    bufsamples -= outsamples;
+
+    if (rewinding)
+      std::memset(audioBuf, 0, outsamples * sizeof *audioBuf);
+
+    if (vidFrameDoneSampleCnt >= 0 && emu->capture)
+      emu->capture->upload(runBuf, runPitch);
+
+    usec_t uploaded = 0;
+    if (blit && emu->frames) {
+      emu->frames->publish();
+      SDL_AtomicSet(&published_frame, frame);
+      SDL_SemPost(emu->frame_ready);
+    } else if (blit) {
+      emu->video_out->upload();
+      uploaded = getusecs();
+    }
+
+    AudioOut::Status const &astatus =
+        emu->aout->write(audioBuf, outsamples, !ff);
+    audioOutBufLow = astatus.low;
+
+    // With dynamic rate control nothing waits for audio, so every frame
+    // waits for its exact time instead
+    usec_t ft = emu->dynamic_rate ? gb_frame_usecs
+                                  : (gb_frame_usecs - gb_frame_usecs / 1024) *
+                                        emu->sample_rate / astatus.rate;
+    if (ff && vidFrameDoneSampleCnt >= 0 && emu->ff_speed > 0)
+      rec.frame_wait_late_usecs =
+          frameWait.waitForNextFrameTime(ft / emu->ff_speed);
+    else if (emu->dynamic_rate && !ff && vidFrameDoneSampleCnt >= 0)
+      rec.frame_wait_late_usecs = frameWait.waitForNextFrameTime(ft);
+    else if (blit && !ff && !emu->frames)
+      rec.frame_wait_late_usecs = frameWait.waitForNextFrameTime(ft);
+
+    if (blit && !emu->frames) {
+      usec_t const presentStart = getusecs();
+      bool const presented = emu->video_out->present();
+      rec.present_usecs = getusecs() - presentStart;
+      // Skipped unchanged frames never reach the screen
+      if (presented)
+        latency_presented(frame, uploaded, presentStart + rec.present_usecs);
+    } else if (blit) {
+      rec.present_usecs = SDL_AtomicGet(&last_present_usecs);
+    }
+
+    if (telemetry_active()) {
+      rec.samples = outsamples;
+      rec.audio_rate = astatus.rate;
+      rec.audio_block_usecs = astatus.blocked;
+      rec.flags = (vidFrameDoneSampleCnt >= 0 ? TELEMETRY_FRAME_DONE : 0) |
+                  (vidFrameDoneSampleCnt >= 0 && !blit ? TELEMETRY_SKIPPED : 0) |
+                  (astatus.low ? TELEMETRY_AUDIO_LOW : 0);
+      telemetry_push(&rec);
+    }
+
+    audioRing.consume(outsamples, bufsamples);
+
+    check_midi_messages(&gb_);
+  }
+
+  return 0;
+}
+
+// Receives the audio output for the capture
+static void capture_audio(void *context, Sint16 const *samples,
+                          std::size_t count) {
+  static_cast<Capture *>(context)->writeAudio(samples, count);
+}
+
+// Flushes queued capture data and completes the files
+static void finish_capture() {
+  delete capture;
+  capture = NULL;
+}
+
+// Writes save states that are still queued
+static void finish_state_slots() {
+  delete state_slots;
+  state_slots = NULL;
+}
+
+// Writes the final battery RAM contents
+static void finish_sram_saver() {
+  sram_saver->snapshot(gb_);
+  delete sram_saver;
+  sram_saver = NULL;
+}
+
+// Waits for the boot state to be cached
+static void finish_boot_cache() {
+  delete boot_cache;
+  boot_cache = NULL;
+}
+
+// Writes the rest of a recorded movie
+static void finish_movie() { movie_close(&movie); }
+
+// Lets the emulation thread finish before SDL and the emulator are torn down
+static void stop_emulation_thread() {
+  if (emulation_thread == NULL)
+    return;
+
+  SDL_AtomicSet(&emulation_running, 0);
+  SDL_WaitThread(emulation_thread, NULL);
+  emulation_thread = NULL;
+}
 
 static int initialize_sdl() {
   const int window_width = 640;  // SDL window width
@@ -79,46 +360,217 @@ static int initialize_sdl() {
 
   SDL_Log("Creating renderer");
   rend = SDL_CreateRenderer(win, -1, SDL_RENDERER_ACCELERATED);
+  if (rend == NULL)
+    SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Could not create renderer: %s",
+                 SDL_GetError());
 
-  SDL_RenderSetLogicalSize(rend, texture_width, texture_height);
+  SDL_RenderSetLogicalSize(rend, gb_screen_width, gb_screen_height);
 
-  // Initialize an SDL texture and a raw framebuffer
-  maintexture = SDL_CreateTexture(rend, SDL_PIXELFORMAT_RGB888,
-                                  SDL_TEXTUREACCESS_STREAMING, texture_width,
-                                  texture_height);
+  // SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
+  return 0;
+}
 
-  // clear the main texture
-  SDL_SetRenderTarget(rend, maintexture);
-  SDL_SetRenderDrawColor(rend, 0, 0, 0, 1);
-  SDL_RenderClear(rend);
+// Returns the factor for the built-in scaler, 1 to let SDL scale instead.
+// SDL's software renderer scales through a slow generic path, so by default
+// frames are scaled by us whenever the renderer is a software one.
+static int pick_scale(const options *opts) {
+  if (opts->scale_mode == SCALE_OFF)
+    return 1;
+
+  if (opts->scale_mode == SCALE_AUTO) {
+    SDL_RendererInfo info;
+    if (SDL_GetRendererInfo(rend, &info) != 0 ||
+        !(info.flags & SDL_RENDERER_SOFTWARE))
+      return 1;
+    SDL_Log("Software renderer in use");
+  }
+
+  if (opts->scale > 0)
+    return opts->scale;
+
+  int width = gb_screen_width, height = gb_screen_height;
+  SDL_GetRendererOutputSize(rend, &width, &height);
+  int const scale = SDL_min(width / gb_screen_width, height / gb_screen_height);
+  return SDL_max(1, SDL_min(scale, (int)Scaler::MAX_FACTOR));
+}
+
+// Battery RAM is kept next to the ROM, named like it with a .sav extension
+// as the core does, unless another file is given
+static std::string savedata_filename(const options *opts) {
+  if (opts->sram_filename != NULL)
+    return opts->sram_filename;
+
+  std::string name(opts->rom_filename);
+  std::string::size_type const dot = name.rfind('.');
+  if (dot != std::string::npos &&
+      (name.rfind('/') == std::string::npos || dot > name.rfind('/')))
+    name.erase(dot);
+
+  return name + ".sav";
+}
+
+// Loads the BIOS and the ROM given on the command line. Both are mapped into
+// memory and handed to the core from there, so the core does not know the
+// ROM's file name and the battery RAM is loaded here. With a cache
+// directory, the boot ROM is skipped if its end state has been cached.
+// Finally, the save state given in the options is loaded.
+static int load_rom(gambatte::GB &gb, const options *opts,
+                    const char *cache_dir) {
+  MappedFile const bios("gbc_bios.bin");
+  int err = bios.failed() ? -1 : gb.loadBios(bios.data(), bios.size());
+  if (err != 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not load BIOS");
+    return err;
+  }
+
+  MappedFile const rom(opts->rom_filename);
+  err = rom.failed() ? -1 : gb.load(rom.data(), rom.size(), GB::CGB_MODE);
+  if (err != 0) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not load ROM");
+    return err;
+  }
+
+  // Starting from the core's own data lets files without the real time
+  // clock data at the end load too
+  Array<char> const savedata(gb.getSavedataLength());
+  Array<char> file;
+  if (savedata.size() > 0 &&
+      readFile(savedata_filename(opts), file)) {
+    gb.saveSavedata(savedata);
+    std::memcpy(savedata, file, SDL_min(file.size(), savedata.size()));
+    gb.loadSavedata(savedata);
+  }
+
+  // The boot ROM's end state cannot be told apart from a loaded state's
+  if (cache_dir != NULL && opts->state_filename == NULL) {
+    boot_cache = new BootCache(cache_dir, rom.data(), rom.size(), bios.data(),
+                               bios.size());
+    atexit(finish_boot_cache);
+    if (boot_cache->restore(gb))
+      SDL_Log("Skipped boot ROM using the cached state");
+  }
+
+  if (opts->state_filename != NULL &&
+      !StateSlots::loadFile(gb, opts->state_filename))
+    return -1;
 
-  // SDL_LogSetAllPriority(SDL_LOG_PRIORITY_DEBUG);
   return 0;
 }
 
+// Starts recording or replaying a movie if asked to, making it the
+// emulator's input. Returns 0 on success.
+static int open_movie(const options *opts) {
+  int err = 0;
+  if (opts->replay_filename != NULL)
+    err = movie_replay(&movie, opts->replay_filename, &gb_, opts->rom_filename);
+  else if (opts->record_filename != NULL)
+    err = movie_record(&movie, opts->record_filename, &gb_, opts->rom_filename);
+  else
+    return 0;
+
+  if (err != 0)
+    return err;
+
+  atexit(finish_movie);
+  gb_.setInputGetter(&movie_get_input, &movie);
+  return 0;
+}
+
+// Resampler the benchmark loop uses unless one is given
+static std::size_t const bench_resampler = 1;
+
+// Returns the resampler given with --resampler, or picks one for out_rate
+static std::size_t choose_resampler(const options *opts, long out_rate) {
+  return opts->resampler >= 0
+             ? opts->resampler
+             : pick_resampler(out_rate, opts->predecimate,
+                              opts->cpu_budget / 100.0);
+}
+
 int main(int argc, char *argv[]) {
 
   // Audio configuration
-  const int sampleRate = 48000;
-  const int latency = 133;
   const int periods = 4;
-  const char *rom_filename;
+  options opts;
 
-  if (argc > 1) {
-    rom_filename = argv[1];
-  } else {
-    printf("No ROM filename specified!\n");
+  if (parse_options(argc, argv, &opts) != 0)
     exit(1);
+
+  int err = 0;
+
+  // Benchmark, latency test and render modes run without a window, renderer or audio
+  // device
+  if (opts.bench_frames > 0) {
+    if (load_rom(gb_, &opts, NULL) != 0 ||
+        (opts.replay_filename != NULL &&
+         movie_replay(&movie, opts.replay_filename, &gb_,
+                      opts.rom_filename) != 0))
+      exit(1);
+
+    // The resampler table at the end shows what would be picked, so
+    // there is no need to measure up front
+    err = run_benchmark(&gb_, opts.bench_frames, opts.audio_rate,
+                        opts.run_ahead, opts.predecimate,
+                        opts.resampler >= 0 ? opts.resampler
+                                            : bench_resampler,
+                        opts.cpu_budget / 100.0,
+                        opts.replay_filename != NULL ? &movie : NULL);
+    movie_close(&movie);
+    return err;
   }
 
+  if (opts.latency_test > 0) {
+    if (load_rom(gb_, &opts, NULL) != 0)
+      exit(1);
+
+    return run_latency_test(&gb_, opts.latency_test, opts.run_ahead);
+  }
+
+  if (opts.render_filename != NULL) {
+    input_script script;
+    if (load_rom(gb_, &opts, NULL) != 0 ||
+        (opts.input_script != NULL &&
+         input_script_load(&script, opts.input_script) != 0))
+      exit(1);
+
+    render_settings settings;
+    settings.seconds = opts.render_seconds;
+    settings.sample_rate = opts.audio_rate;
+    settings.native = opts.render_native;
+    settings.predecimate = opts.predecimate;
+    settings.resampler_index =
+        opts.render_native ? 0 : choose_resampler(&opts, opts.audio_rate);
+    settings.script = opts.input_script != NULL ? &script : NULL;
+
+    if (opts.render_stems) {
+      // One emulator per stem, all starting from the same state
+      Array<gambatte::GB> stems(STEM_MAX);
+      gambatte::GB *gbs[STEM_MAX];
+      for (int i = 0; i < STEM_MAX; i++) {
+        if (load_rom(stems[i], &opts, NULL) != 0)
+          exit(1);
+        gbs[i] = &stems[i];
+      }
+
+      err = run_stem_render(gbs, opts.render_filename, &settings);
+    } else {
+      err = run_render(&gb_, opts.render_filename, &settings);
+    }
+
+    if (opts.input_script != NULL)
+      input_script_free(&script);
+
+    return err;
+  }
+
+  // The headless modes above do not look at the quit flag and keep the
+  // default signal handling, which ends them right away
   signal(SIGINT, int_handler);
   signal(SIGTERM, int_handler);
 #ifdef SIGQUIT
   signal(SIGQUIT, int_handler);
 #endif
 
-  int err = 0;
-
   err = initialize_sdl();
 
   if (err != 0) {
@@ -131,71 +583,138 @@ int main(int argc, char *argv[]) {
 
   midi_setup();
 
-  std::size_t bufsamples = 0;
-  uint *bytes = nullptr;
-  Array<Uint32> const audioBuf(gb_samples_per_frame +
-                               gambatte_max_overproduction);
-  AudioOut aout(sampleRate, latency, periods, ResamplerInfo::get(1),
-                audioBuf.size());
-  FrameWait frameWait;
-  SkipSched skipSched;
-  bool audioOutBufLow = false;
-  int maintexture_pitch = 0;
+  if (opts.telemetry_filename != NULL)
+    telemetry_setup(opts.telemetry_filename);
 
-  gb_.setInputGetter((gambatte::InputGetter *)&get_input, NULL);
-
-  SDL_PauseAudio(0);
-
-  err = gb_.loadBios("gbc_bios.bin", 0, 0);
-  if (err != 0) {
-    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not load BIOS");
-    exit(1);
+  if (opts.latency) {
+    latency_enable();
+    atexit(latency_report);
   }
 
-  err = gb_.load(rom_filename, GB::CGB_MODE);
-  if (err != 0) {
-    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not load ROM");
-    exit(1);
+  AudioOut aout(opts.audio_rate, opts.audio_latency, periods,
+                !opts.fixed_latency, opts.dynamic_rate);
+  long const sampleRate = aout.sampleRate();
+  aout.setResampler(opts.predecimate,
+                    ResamplerInfo::get(choose_resampler(&opts, sampleRate)),
+                    gb_samples_per_frame + gambatte_max_overproduction);
+  // Without a renderer, run without showing anything. Skipping unchanged
+  // frames needs them in system memory, so frames are only rendered
+  // straight into the texture with --present-all.
+  scoped_ptr<VideoSink> const videoOut(
+      rend ? static_cast<VideoSink *>(new VideoOut(
+                 rend, gb_screen_width, gb_screen_height,
+                 (opts.threaded || !opts.present_all ? 0 : VideoOut::DIRECT) |
+                     (opts.present_all ? 0 : VideoOut::SKIP_UNCHANGED) |
+                     (opts.rgb565 ? VideoOut::RGB565 : 0),
+                 pick_scale(&opts),
+                 opts.scale_mode == SCALE_SCALEX ? Scaler::SCALEX
+                                                 : Scaler::NEAREST))
+           : new NullVideoSink(gb_screen_width, gb_screen_height));
+  TripleBuffer<uint_least32_t> frames(opts.threaded
+                                          ? gb_screen_width * gb_screen_height
+                                          : 0);
+
+  if (opts.capture_filename != NULL) {
+    capture = new Capture(opts.capture_filename, gb_screen_width, gb_screen_height,
+                          sampleRate);
+    if (capture->failed())
+      exit(1);
+    atexit(finish_capture);
+    aout.setTap(capture_audio, capture);
   }
 
-  for (;;) {
+  emulation emu;
+  emu.aout = &aout;
+  emu.sample_rate = sampleRate;
+  emu.video_out = videoOut.get();
+  emu.frames = opts.threaded ? &frames : NULL;
+  emu.frame_ready = opts.threaded ? SDL_CreateSemaphore(0) : NULL;
+  emu.capture = capture;
+  emu.ff_speed = opts.ff_speed;
+  emu.run_ahead = opts.run_ahead;
+  emu.dynamic_rate = opts.dynamic_rate;
+
+  scoped_ptr<Rewind> const rewind(
+      opts.rewind_mb > 0 ? new Rewind(opts.rewind_mb * 1024ul * 1024ul,
+                                      opts.rewind_interval)
+                         : 0);
+  emu.rewind = rewind.get();
+
+  state_slots = new StateSlots(opts.rom_filename);
+  atexit(finish_state_slots);
+  emu.slots = state_slots;
+
+  // The main thread keeps the input state up to date from SDL events, and
+  // the emulator only reads it
+  gb_.setInputGetter((gambatte::InputGetter *)&get_input, NULL);
 
-    std::size_t runsamples = gb_samples_per_frame - bufsamples;
-    std::ptrdiff_t const vidFrameDoneSampleCnt =
-        gb_.runFor(videoBuf, texture_width, audioBuf + bufsamples, runsamples);
-    std::size_t const outsamples = vidFrameDoneSampleCnt >= 0
-                                       ? bufsamples + vidFrameDoneSampleCnt
-                                       : bufsamples + runsamples;
-    bufsamples += runsamples;
-    bufsamples -= outsamples;
+  aout.start();
 
-    bool const blit =
-        vidFrameDoneSampleCnt >= 0 && !skipSched.skipNext(audioOutBufLow);
-
-    if (blit) {
-      SDL_LockTexture(maintexture, nullptr, reinterpret_cast<void **>(&bytes),
-                      &maintexture_pitch);
-      SDL_memcpy(bytes, videoBuf,
-                 texture_width * texture_height * sizeof(uint32_t));
-      SDL_UnlockTexture(maintexture);
-    }
+  // A replay starts from the movie's state, which must not end up in the
+  // boot cache
+  char *const pref_path = SDL_GetPrefPath("", "gambatte-sdl2");
+  err = load_rom(gb_, &opts,
+                 opts.boot_cache && opts.replay_filename == NULL ? pref_path
+                                                                 : NULL);
+  SDL_free(pref_path);
+  if (err != 0 || open_movie(&opts) != 0)
+    exit(1);
 
-    AudioOut::Status const &astatus = aout.write(audioBuf, outsamples);
-    audioOutBufLow = astatus.low;
+  emu.movie = movie.file != NULL ? &movie : NULL;
 
-    if (blit) {
-      usec_t ft = (16743ul - 16743 / 1024) * sampleRate / astatus.rate;
-      frameWait.waitForNextFrameTime(ft);
-      render_sdl();
-    }
+  // Without a cached state, the state is cached when the boot ROM finishes
+  emu.boot = boot_cache && !boot_cache->restored() ? boot_cache : NULL;
 
-    std::memmove(audioBuf, audioBuf + outsamples,
-                 bufsamples * sizeof *audioBuf);
+  // Replays never write the battery save
+  if (gb_.getSavedataLength() > 0 && opts.replay_filename == NULL) {
+    sram_saver = new SramSaver(gb_, savedata_filename(&opts),
+                               sram_interval_frames, opts.sram_journal);
+    atexit(finish_sram_saver);
+  }
+  emu.sram = sram_saver;
 
-    check_midi_messages(&gb_);
+  SDL_AtomicSet(&emulation_running, 1);
+
+  // Quitting returns from main, so the exit handlers finish the files and
+  // shut down SDL. None of them refer to the locals here.
+  if (!opts.threaded) {
+    emulate(&emu);
+    return 0;
   }
 
-  destroy_sdl();
+  SDL_Log("Starting emulation thread");
+  emulation_thread = SDL_CreateThread(emulate, "emulation", &emu);
+  if (emulation_thread == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not create thread: %s",
+                 SDL_GetError());
+    exit(1);
+  }
+  atexit(stop_emulation_thread);
+
+  // Present the newest complete frame whenever one is published
+  while (!quit_requested()) {
+    SDL_SemWaitTimeout(emu.frame_ready, 100);
+    handle_sdl_events();
+
+    // Taken before the update, so that the frame presented is never older
+    // than the number says
+    unsigned const published = SDL_AtomicGet(&published_frame);
+    if (frames.update()) {
+      usec_t const presentStart = getusecs();
+      videoOut->upload(frames.front(), gb_screen_width);
+      usec_t const uploaded = getusecs();
+      bool const shown = videoOut->present();
+      usec_t const presented = getusecs();
+      SDL_AtomicSet(&last_present_usecs, presented - presentStart);
+      if (shown)
+        latency_presented(published, uploaded, presented);
+    }
+  }
 
+  // The thread uses the audio output, the frames and the semaphore, which
+  // go away when main returns, so it has to finish first. Audio keeps
+  // playing meanwhile, so it cannot stay blocked on a full buffer.
+  stop_emulation_thread();
+  SDL_DestroySemaphore(emu.frame_ready);
   return 0;
-}
\ No newline at end of file
+}
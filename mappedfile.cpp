@@ -0,0 +1,32 @@
+#include "mappedfile.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(char const *const filename)
+: data_(0)
+, size_(0)
+{
+	int const fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return;
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *const p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			// The whole file is read right away
+			madvise(p, st.st_size, MADV_WILLNEED);
+			data_ = static_cast<char const *>(p);
+			size_ = st.st_size;
+		}
+	}
+
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (data_)
+		munmap(const_cast<char *>(data_), size_);
+}
@@ -0,0 +1,22 @@
+#ifndef MAPPED_FILE_H_
+#define MAPPED_FILE_H_
+
+#include <common/uncopyable.h>
+#include <cstddef>
+
+// Read-only memory mapping of a whole file
+class MappedFile : Uncopyable {
+public:
+	explicit MappedFile(char const *filename);
+	~MappedFile();
+
+	bool failed() const { return !data_; }
+	char const * data() const { return data_; }
+	std::size_t size() const { return size_; }
+
+private:
+	char const *data_;
+	std::size_t size_;
+};
+
+#endif
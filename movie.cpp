@@ -0,0 +1,225 @@
+#include "movie.h"
+#include "input.h"
+#include "mappedfile.h"
+#include "statebuffer.h"
+#include "SDL_log.h"
+
+#include <common/array.h>
+#include <limits.h>
+#include <string.h>
+#include <zlib.h>
+
+static const char movie_magic[4] = {'G', 'B', 'S', 'M'};
+static unsigned long const movie_version = 1;
+
+static void write_u32(FILE *f, unsigned long value) {
+  for (int i = 0; i < 4; i++)
+    fputc(value >> i * 8 & 0xff, f);
+}
+
+static bool read_u32(FILE *f, unsigned long *value) {
+  *value = 0;
+  for (int i = 0; i < 4; i++) {
+    int const c = fgetc(f);
+    if (c == EOF)
+      return false;
+    *value |= (unsigned long)c << i * 8;
+  }
+  return true;
+}
+
+// Size and CRC-32 of the ROM file. Returns false if it cannot be read.
+static bool rom_id(const char *rom_filename, unsigned long *size,
+                   unsigned long *crc) {
+  MappedFile const rom(rom_filename);
+  if (rom.failed())
+    return false;
+
+  *size = rom.size();
+  *crc = crc32(crc32(0, NULL, 0),
+               reinterpret_cast<const Bytef *>(rom.data()), rom.size());
+  return true;
+}
+
+static void movie_open(input_movie *movie, FILE *file, bool recording) {
+  movie->file = file;
+  movie->recording = recording;
+  movie->speculating = false;
+  movie->ended = false;
+  movie->buttons = 0;
+  movie->calls = 0;
+  movie->total_calls = 0;
+  setvbuf(file, movie->buffer, _IOFBF, sizeof movie->buffer);
+}
+
+int movie_record(input_movie *movie, const char *filename, gambatte::GB *gb,
+                 const char *rom_filename) {
+  unsigned long rom_size, rom_crc;
+  StateBuffer state;
+  if (!rom_id(rom_filename, &rom_size, &rom_crc) || !state.save(*gb)) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot take the movie's start state");
+    return -1;
+  }
+
+  FILE *file = fopen(filename, "wb");
+  if (file == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot create movie %s", filename);
+    return -1;
+  }
+
+  movie_open(movie, file, true);
+  fwrite(movie_magic, 1, sizeof movie_magic, file);
+  write_u32(file, movie_version);
+  write_u32(file, rom_size);
+  write_u32(file, rom_crc);
+  write_u32(file, state.size());
+  fwrite(state.data(), 1, state.size(), file);
+
+  SDL_Log("Recording input to %s", filename);
+  return 0;
+}
+
+int movie_replay(input_movie *movie, const char *filename, gambatte::GB *gb,
+                 const char *rom_filename) {
+  FILE *file = fopen(filename, "rb");
+  if (file == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot open movie %s", filename);
+    return -1;
+  }
+
+  movie_open(movie, file, false);
+
+  char magic[sizeof movie_magic];
+  unsigned long version, size, crc, state_size;
+  if (fread(magic, 1, sizeof magic, file) != sizeof magic ||
+      memcmp(magic, movie_magic, sizeof magic) != 0 ||
+      !read_u32(file, &version) || version != movie_version ||
+      !read_u32(file, &size) || !read_u32(file, &crc) ||
+      !read_u32(file, &state_size)) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "%s is not a movie", filename);
+    fclose(file);
+    return -1;
+  }
+
+  unsigned long rom_size, rom_crc;
+  if (!rom_id(rom_filename, &rom_size, &rom_crc) || rom_size != size ||
+      rom_crc != crc) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM,
+                 "Movie %s was recorded with another ROM", filename);
+    fclose(file);
+    return -1;
+  }
+
+  Array<char> const state(state_size);
+  if (fread(state, 1, state_size, file) != state_size ||
+      !gb->loadState(state, state_size)) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot load the state of movie %s",
+                 filename);
+    fclose(file);
+    return -1;
+  }
+
+  SDL_Log("Replaying input from %s", filename);
+  return 0;
+}
+
+static void write_run(input_movie *movie) {
+  fputc(movie->buttons, movie->file);
+  unsigned long n = movie->calls;
+  while (n >= 0x80) {
+    fputc((n & 0x7f) | 0x80, movie->file);
+    n >>= 7;
+  }
+  fputc(n, movie->file);
+}
+
+// Reads the next run. Returns false at the end of the movie, or where it is
+// damaged.
+static bool read_run(input_movie *movie) {
+  int const buttons = fgetc(movie->file);
+  if (buttons == EOF)
+    return false;
+
+  int const bits = sizeof(unsigned long) * CHAR_BIT;
+  unsigned long calls = 0;
+  for (int shift = 0;; shift += 7) {
+    int const c = fgetc(movie->file);
+    if (c == EOF)
+      return false;
+
+    // More bytes than the count has room for, or bits that would be shifted
+    // out of it, only come from a damaged file
+    if (shift >= bits || (shift > bits - 7 && (c & 0x7f) >> (bits - shift))) {
+      SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Movie file is damaged");
+      return false;
+    }
+
+    calls |= (unsigned long)(c & 0x7f) << shift;
+    if (!(c & 0x80))
+      break;
+  }
+
+  if (calls == 0)
+    return false;
+
+  movie->buttons = buttons;
+  movie->calls = calls;
+  return true;
+}
+
+static unsigned record_input(input_movie *movie) {
+  unsigned const buttons = get_input();
+  if (movie->speculating)
+    return buttons;
+
+  if (buttons != movie->buttons && movie->calls > 0) {
+    write_run(movie);
+    movie->calls = 0;
+  }
+
+  movie->buttons = buttons;
+  movie->calls++;
+  movie->total_calls++;
+  return buttons;
+}
+
+static unsigned replay_input(input_movie *movie) {
+  if (movie->calls == 0 && !movie->ended && !read_run(movie)) {
+    SDL_Log("Movie ended after %llu input reads", movie->total_calls);
+    movie->ended = true;
+    movie->buttons = 0;
+  }
+
+  // Running ahead sees the buttons the next real call gets
+  if (movie->ended || movie->speculating)
+    return movie->buttons;
+
+  movie->calls--;
+  movie->total_calls++;
+  return movie->buttons;
+}
+
+unsigned movie_get_input(void *p) {
+  input_movie *movie = static_cast<input_movie *>(p);
+  return movie->recording ? record_input(movie) : replay_input(movie);
+}
+
+int movie_close(input_movie *movie) {
+  if (movie->file == NULL)
+    return 0;
+
+  if (movie->recording && movie->calls > 0)
+    write_run(movie);
+
+  int err = ferror(movie->file);
+  if (fclose(movie->file) != 0)
+    err = 1;
+
+  movie->file = NULL;
+  if (movie->recording && err != 0)
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not write the movie");
+  else if (movie->recording)
+    SDL_Log("Recorded %llu input reads", movie->total_calls);
+
+  return err != 0 ? -1 : 0;
+}
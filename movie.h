@@ -0,0 +1,51 @@
+#ifndef MOVIE_H_
+#define MOVIE_H_
+
+#include "gambatte.h"
+#include <stdio.h>
+
+// Input movie: the buttons returned by every call of the emulator's input
+// getter, from a save state taken when recording started. Replaying a movie
+// on the same ROM loads that state and hands the same buttons to the same
+// calls, so emulation runs exactly as it did when recording, apart from
+// games that read a real time clock.
+//
+// A movie file is written front to back and only appended to:
+//
+//   "GBSM", version, ROM size, ROM CRC-32 (32 bit little endian each)
+//   state size (32 bit little endian) and the save state
+//   runs: buttons held (one byte, see input_buttons_t), then for how many
+//         getter calls (LEB128)
+//
+// A run is written when the buttons change, through a buffer set up when
+// the movie is opened, so recording does not allocate while emulating.
+
+#define MOVIE_BUFFER_SIZE 4096
+
+typedef struct input_movie {
+  FILE *file;
+  bool recording;
+  bool speculating; // running ahead, calls are not part of the movie
+  bool ended;       // replayed to the end
+  unsigned buttons; // held in the current run
+  unsigned long calls; // made in the current run, or left of it if replaying
+  unsigned long long total_calls;
+  char buffer[MOVIE_BUFFER_SIZE];
+} input_movie;
+
+// Start recording the buttons get_input returns from the current state of
+// gb, or start replaying a movie recorded on the same ROM by loading its
+// state into gb. Both return 0 on success. Movies must be closed with
+// movie_close.
+int movie_record(input_movie *movie, const char *filename, gambatte::GB *gb,
+                 const char *rom_filename);
+int movie_replay(input_movie *movie, const char *filename, gambatte::GB *gb,
+                 const char *rom_filename);
+
+// Input getter for gambatte, with the movie as its data
+unsigned movie_get_input(void *movie);
+
+// Returns 0 if everything recorded was written
+int movie_close(input_movie *movie);
+
+#endif
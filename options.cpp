@@ -0,0 +1,262 @@
+#include "options.h"
+#include "resample/resamplerinfo.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static void print_usage(const char *program) {
+  printf("Usage: %s [options] <rom file>\n"
+         "Options:\n"
+         "  --threaded        Run emulation and presentation on separate "
+         "threads\n"
+         "  --bench <frames>  Run headless for <frames> frames as fast as "
+         "possible and\n"
+         "                    print timing statistics\n"
+         "  --telemetry <csv> Record per-frame timings to shared memory and "
+         "write\n"
+         "                    them to <csv> on exit\n"
+         "  --latency         Measure input to photon latency and print a "
+         "histogram\n"
+         "                    on exit\n"
+         "  --latency-test <n>\n"
+         "                    Measure input latency headless over <n> "
+         "synthetic\n"
+         "                    button changes\n"
+         "  --scaler <mode>   Built-in integer scaler: auto (default, used "
+         "with\n"
+         "                    software rendering), off, nearest or scalex\n"
+         "  --scale <1-6>     Built-in scaler factor (default: fit the "
+         "display)\n"
+         "  --present-all     Upload and present frames even if they did not "
+         "change\n"
+         "  --rgb565          Output 16 bit RGB565 frames\n"
+         "  --capture <file>  Record every frame to <file> (Y4M if it ends "
+         "in .y4m,\n"
+         "                    raw RGB24 otherwise) and audio to <file>.wav\n"
+         "  --ff-speed <n>    Limit fast forward to <n> times realtime "
+         "(default:\n"
+         "                    unlimited)\n"
+         "  --run-ahead <n>   Show frames <n> frames ahead of emulation to "
+         "hide\n"
+         "                    input latency\n"
+         "  --rewind <mb>     Keep up to <mb> megabytes of history for "
+         "rewinding\n"
+         "  --rewind-interval <n>\n"
+         "                    Capture a rewind state every <n> frames "
+         "(default: 2)\n"
+         "  --sram-journal <n>\n"
+         "                    Keep the last <n> versions of the battery save\n"
+         "  --no-boot-cache   Always run the boot ROM\n"
+         "  --audio-rate <hz> Output sample rate (default: 48000)\n"
+         "  --audio-latency <ms>\n"
+         "                    Most audio to buffer (default: 133)\n"
+         "  --fixed-latency   Always buffer --audio-latency ms of audio "
+         "instead of\n"
+         "                    finding the lowest latency that does not "
+         "crackle\n"
+         "  --dynamic-rate    Pace emulation by the timer and adjust the "
+         "audio rate\n"
+         "                    slightly to match instead of waiting for "
+         "audio\n"
+         "  --predecimate     Decimate audio by 16 before resampling, which "
+         "is cheaper\n"
+         "                    but rolls off the treble slightly\n"
+         "  --resampler <n>   Resampler to use as listed by --bench, or auto "
+         "(default)\n"
+         "                    to pick one by --cpu-budget\n"
+         "  --cpu-budget <percent>\n"
+         "                    Share of a core the resampler may take when "
+         "picking\n"
+         "                    automatically (default: 5)\n"
+         "  --render <wav>    Render the rom's audio to <wav> headlessly as "
+         "fast as\n"
+         "                    possible and exit\n"
+         "  --render-seconds <n>\n"
+         "                    Emulated seconds to render (default: 60)\n"
+         "  --render-native   Render at the emulator's 2097152 Hz instead of\n"
+         "                    --audio-rate\n"
+         "  --input-script <file>\n"
+         "                    Press buttons from <file> while rendering\n"
+         "  --state <file>    Start from a save state file\n"
+         "  --sram <file>     Battery save to use instead of <rom>.sav\n"
+         "  --stems           With --render, write each sound channel to its "
+         "own file\n"
+         "  --record <file>   Record the input to a movie file\n"
+         "  --replay <file>   Replay the input from a movie file\n",
+         program);
+}
+
+// Parses command line arguments into opts. Returns 0 on success.
+int parse_options(int argc, char *argv[], options *opts) {
+  memset(opts, 0, sizeof *opts);
+  opts->rewind_interval = 2;
+  opts->boot_cache = true;
+  opts->audio_rate = 48000;
+  opts->audio_latency = 133;
+  opts->resampler = -1;
+  opts->cpu_budget = 5;
+  opts->render_seconds = 60;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--threaded") == 0) {
+      opts->threaded = true;
+    } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+      opts->bench_frames = strtol(argv[++i], NULL, 10);
+      if (opts->bench_frames <= 0) {
+        printf("Invalid frame count: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--telemetry") == 0 && i + 1 < argc) {
+      opts->telemetry_filename = argv[++i];
+    } else if (strcmp(argv[i], "--latency") == 0) {
+      opts->latency = true;
+    } else if (strcmp(argv[i], "--latency-test") == 0 && i + 1 < argc) {
+      opts->latency_test = atoi(argv[++i]);
+      if (opts->latency_test <= 0 || opts->latency_test > 4096) {
+        printf("Invalid input change count: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--present-all") == 0) {
+      opts->present_all = true;
+    } else if (strcmp(argv[i], "--rgb565") == 0) {
+      opts->rgb565 = true;
+    } else if (strcmp(argv[i], "--ff-speed") == 0 && i + 1 < argc) {
+      opts->ff_speed = atoi(argv[++i]);
+      if (opts->ff_speed < 0) {
+        printf("Invalid fast forward speed: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+      opts->run_ahead = atoi(argv[++i]);
+      if (opts->run_ahead < 0 || opts->run_ahead > 8) {
+        printf("Invalid run-ahead frame count: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--rewind") == 0 && i + 1 < argc) {
+      opts->rewind_mb = atoi(argv[++i]);
+      if (opts->rewind_mb < 0 || opts->rewind_mb > 1024) {
+        printf("Invalid rewind history size: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--rewind-interval") == 0 && i + 1 < argc) {
+      opts->rewind_interval = atoi(argv[++i]);
+      if (opts->rewind_interval < 1 || opts->rewind_interval > 60) {
+        printf("Invalid rewind interval: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--sram-journal") == 0 && i + 1 < argc) {
+      opts->sram_journal = atoi(argv[++i]);
+      if (opts->sram_journal < 0 || opts->sram_journal > 99) {
+        printf("Invalid journal length: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--no-boot-cache") == 0) {
+      opts->boot_cache = false;
+    } else if (strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) {
+      opts->audio_rate = atoi(argv[++i]);
+      if (opts->audio_rate < 8000 || opts->audio_rate > 192000) {
+        printf("Invalid sample rate: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc) {
+      opts->audio_latency = atoi(argv[++i]);
+      if (opts->audio_latency < 10 || opts->audio_latency > 1000) {
+        printf("Invalid audio latency: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--fixed-latency") == 0) {
+      opts->fixed_latency = true;
+    } else if (strcmp(argv[i], "--dynamic-rate") == 0) {
+      opts->dynamic_rate = true;
+    } else if (strcmp(argv[i], "--predecimate") == 0) {
+      opts->predecimate = true;
+    } else if (strcmp(argv[i], "--resampler") == 0 && i + 1 < argc) {
+      const char *n = argv[++i];
+      if (strcmp(n, "auto") == 0) {
+        opts->resampler = -1;
+      } else {
+        opts->resampler = atoi(n);
+        if (opts->resampler < 0 ||
+            opts->resampler >= (int)ResamplerInfo::num()) {
+          printf("Invalid resampler: %s\n", n);
+          return 1;
+        }
+      }
+    } else if (strcmp(argv[i], "--cpu-budget") == 0 && i + 1 < argc) {
+      opts->cpu_budget = atoi(argv[++i]);
+      if (opts->cpu_budget < 1 || opts->cpu_budget > 100) {
+        printf("Invalid CPU budget: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--render") == 0 && i + 1 < argc) {
+      opts->render_filename = argv[++i];
+    } else if (strcmp(argv[i], "--render-seconds") == 0 && i + 1 < argc) {
+      opts->render_seconds = strtol(argv[++i], NULL, 10);
+      if (opts->render_seconds <= 0) {
+        printf("Invalid render length: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--render-native") == 0) {
+      opts->render_native = true;
+    } else if (strcmp(argv[i], "--stems") == 0) {
+      opts->render_stems = true;
+    } else if (strcmp(argv[i], "--input-script") == 0 && i + 1 < argc) {
+      opts->input_script = argv[++i];
+    } else if (strcmp(argv[i], "--state") == 0 && i + 1 < argc) {
+      opts->state_filename = argv[++i];
+    } else if (strcmp(argv[i], "--sram") == 0 && i + 1 < argc) {
+      opts->sram_filename = argv[++i];
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      opts->record_filename = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      opts->replay_filename = argv[++i];
+    } else if (strcmp(argv[i], "--capture") == 0 && i + 1 < argc) {
+      opts->capture_filename = argv[++i];
+    } else if (strcmp(argv[i], "--scaler") == 0 && i + 1 < argc) {
+      const char *mode = argv[++i];
+      if (strcmp(mode, "auto") == 0) {
+        opts->scale_mode = SCALE_AUTO;
+      } else if (strcmp(mode, "off") == 0) {
+        opts->scale_mode = SCALE_OFF;
+      } else if (strcmp(mode, "nearest") == 0) {
+        opts->scale_mode = SCALE_NEAREST;
+      } else if (strcmp(mode, "scalex") == 0) {
+        opts->scale_mode = SCALE_SCALEX;
+      } else {
+        printf("Invalid scaler: %s\n", mode);
+        return 1;
+      }
+    } else if (strcmp(argv[i], "--scale") == 0 && i + 1 < argc) {
+      opts->scale = atoi(argv[++i]);
+      if (opts->scale < 1 || opts->scale > 6) {
+        printf("Invalid scale factor: %s\n", argv[i]);
+        return 1;
+      }
+    } else if (strncmp(argv[i], "--", 2) == 0) {
+      printf("Unknown option: %s\n", argv[i]);
+      print_usage(argv[0]);
+      return 1;
+    } else {
+      opts->rom_filename = argv[i];
+    }
+  }
+
+  if (opts->record_filename != NULL && opts->replay_filename != NULL) {
+    printf("Cannot record and replay a movie at the same time\n");
+    return 1;
+  }
+
+  if ((opts->record_filename != NULL || opts->replay_filename != NULL) &&
+      (opts->render_filename != NULL || opts->latency_test > 0)) {
+    printf("Movies cannot be used with --render or --latency-test\n");
+    return 1;
+  }
+
+  if (opts->rom_filename == NULL) {
+    printf("No ROM filename specified!\n");
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,49 @@
+#ifndef OPTIONS_H_
+#define OPTIONS_H_
+
+typedef enum scale_mode_t {
+  SCALE_AUTO,    // use the built-in scaler if the renderer is software
+  SCALE_OFF,     // always let SDL scale
+  SCALE_NEAREST, // always use the built-in nearest neighbour scaler
+  SCALE_SCALEX   // always use the built-in Scale2x/Scale3x scaler
+} scale_mode_t;
+
+typedef struct options {
+  const char *rom_filename;
+  bool threaded;     // run emulation and presentation on separate threads
+  long bench_frames; // run headless benchmark for this many frames if > 0
+  const char *telemetry_filename; // record loop timings, write CSV on exit
+  bool latency;      // measure input latency, print a histogram on exit
+  int latency_test;  // measure this many synthetic input changes headless
+  scale_mode_t scale_mode;
+  int scale; // built-in scaler factor, 0 to fit the display
+  bool present_all; // present every frame, even if unchanged
+  bool rgb565;      // use a 16 bit RGB565 texture
+  const char *capture_filename; // record video (and audio next to it)
+  int ff_speed; // fast forward speed cap as a multiple of realtime, 0 = none
+  int run_ahead; // frames to run ahead to hide input latency
+  int rewind_mb;       // rewind history size in megabytes, 0 to disable
+  int rewind_interval; // frames between rewind states
+  int sram_journal;    // previous battery RAM versions to keep
+  bool boot_cache;     // skip the boot ROM using a cached state
+  int audio_rate;      // requested output sample rate in Hz
+  int audio_latency;   // audio buffer size in ms, the maximum if adaptive
+  bool fixed_latency;  // keep the audio buffer at audio_latency
+  bool dynamic_rate;   // pace by timer and adapt the audio rate to it
+  bool predecimate;     // decimate before resampling
+  int resampler;       // ResamplerInfo entry, -1 to pick one by cpu_budget
+  int cpu_budget;      // percent of a core the resampler may take
+  const char *render_filename; // render audio headlessly to this WAV file
+  long render_seconds;         // emulated time to render
+  bool render_native;          // render at the emulator's sample rate
+  bool render_stems;           // render each sound channel to its own file
+  const char *input_script;    // buttons to press while rendering
+  const char *state_filename;  // save state to start from
+  const char *sram_filename;   // battery save to use instead of <rom>.sav
+  const char *record_filename; // record input to this movie file
+  const char *replay_filename; // replay input from this movie file
+} options;
+
+int parse_options(int argc, char *argv[], options *opts);
+
+#endif
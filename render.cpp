@@ -0,0 +1,241 @@
+#include "render.h"
+#include "gbframe.h"
+#include "resamplechain.h"
+#include "wavwriter.h"
+
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <common/array.h>
+#include <cstring>
+#include <stdio.h>
+#include <string>
+
+// Sound panning register. Each channel has a bit for either side.
+static unsigned short const nr51_address = 0xff25;
+static unsigned const all_channels = 0xff;
+// The core has no way to mute a channel, so a stem's channel mask is
+// written into NR51 between runs this many samples long, clearing whatever
+// the game enabled. Anything the game turns on shows up for at most this
+// long (about 0.12 ms).
+static std::size_t const mask_interval = 256;
+
+static const char *const stem_names[STEM_MAX] = {"pulse1", "pulse2", "wave",
+                                                 "noise"};
+
+typedef struct render_job {
+  gambatte::GB *gb;
+  std::string filename;
+  unsigned channels; // NR51 bits to keep
+  const render_settings *settings;
+  int result;
+  long frames;
+  unsigned long long written;
+} render_job;
+
+typedef struct render_input {
+  input_script script; // a copy, with its own position
+  unsigned buttons;
+} render_input;
+
+static unsigned scripted_input(void *data) {
+  return static_cast<render_input *>(data)->buttons;
+}
+
+static void mask_channels(gambatte::GB *gb, unsigned channels) {
+  unsigned const nr51 = gb->externalRead(nr51_address);
+  if (nr51 & ~channels)
+    gb->externalWrite(nr51_address, nr51 & channels);
+}
+
+static void render(render_job *job) {
+  render_settings const *const settings = job->settings;
+  gambatte::GB *const gb = job->gb;
+  Array<Uint32> const audioBuf(gb_samples_per_frame +
+                               gambatte_max_overproduction);
+  ResampleChain chain(settings->sample_rate, settings->predecimate,
+                      ResamplerInfo::get(settings->resampler_index),
+                      audioBuf.size());
+  Array<Sint16> const resampleBuf(chain.maxOut(audioBuf.size()) * 2);
+  // The core needs somewhere to draw, even if nothing is shown
+  Array<uint_least32_t> const videoBuf(gb_screen_width * gb_screen_height);
+
+  job->result = 1;
+  job->frames = 0;
+  job->written = 0;
+
+  // Sizes in WAV headers are 32 bits
+  long const wav_rate = settings->native ? gb_sample_rate : settings->sample_rate;
+  unsigned long long const max_bytes = 0xffffffffull - 44;
+  if (static_cast<unsigned long long>(settings->seconds) * wav_rate * 4 >
+      max_bytes) {
+    printf("Cannot render more than %ld s at %ld Hz into a WAV file\n",
+           static_cast<long>(max_bytes / (wav_rate * 4ull)), wav_rate);
+    return;
+  }
+
+  WavWriter wav;
+  if (!wav.open(job->filename.c_str(), wav_rate, 2))
+    return;
+
+  render_input input;
+  std::memset(&input, 0, sizeof input);
+  if (settings->script != NULL) {
+    input.script = *settings->script;
+    input.script.next = 0;
+    input.buttons = input_script_at(&input.script, 0);
+  }
+  gb->setInputGetter(&scripted_input, &input);
+
+  bool const masked = job->channels != all_channels;
+  std::size_t const slice = masked ? mask_interval : gb_samples_per_frame;
+  if (masked)
+    mask_channels(gb, job->channels);
+
+  unsigned long long const total =
+      static_cast<unsigned long long>(settings->seconds) * gb_sample_rate;
+  unsigned long long emulated = 0;
+  std::size_t bufsamples = 0;
+
+  while (emulated < total) {
+    std::size_t const before = bufsamples;
+    std::size_t runsamples = gb_samples_per_frame - bufsamples;
+    if (runsamples > slice)
+      runsamples = slice;
+
+    std::ptrdiff_t const vidFrameDoneSampleCnt =
+        gb->runFor(videoBuf, gb_screen_width, audioBuf + before, runsamples);
+    bufsamples += runsamples;
+    if (masked)
+      mask_channels(gb, job->channels);
+
+    // Audio is handled a frame at a time, however short the runs are
+    std::size_t outsamples = bufsamples;
+    if (vidFrameDoneSampleCnt >= 0) {
+      outsamples = before + vidFrameDoneSampleCnt;
+      ++job->frames;
+      if (settings->script != NULL)
+        input.buttons = input_script_at(&input.script, job->frames);
+    } else if (bufsamples < gb_samples_per_frame) {
+      continue;
+    }
+
+    bufsamples -= outsamples;
+
+    // Cut the last frame off at the requested length
+    if (outsamples > total - emulated)
+      outsamples = total - emulated;
+    emulated += outsamples;
+
+    Sint16 const *const samples =
+        reinterpret_cast<Sint16 const *>(audioBuf.get());
+    if (settings->native) {
+      wav.write(samples, outsamples);
+      job->written += outsamples;
+    } else {
+      std::size_t const n = chain.resample(resampleBuf, samples, outsamples);
+      wav.write(resampleBuf, n);
+      job->written += n;
+    }
+
+    std::memmove(audioBuf, audioBuf + outsamples,
+                 bufsamples * sizeof *audioBuf);
+  }
+
+  wav.close();
+  job->result = 0;
+}
+
+static double seconds_since(Uint64 start) {
+  return static_cast<double>(SDL_GetPerformanceCounter() - start) /
+         SDL_GetPerformanceFrequency();
+}
+
+int run_render(gambatte::GB *gb, const char *wav_filename,
+               const render_settings *settings) {
+  render_job job;
+  job.gb = gb;
+  job.filename = wav_filename;
+  job.channels = all_channels;
+  job.settings = settings;
+
+  Uint64 const start = SDL_GetPerformanceCounter();
+  render(&job);
+  if (job.result != 0)
+    return job.result;
+
+  double const wall_s = seconds_since(start);
+  printf("Rendered %ld s (%ld frames, %llu samples) to %s in %.1f s, "
+         "%.1fx realtime\n",
+         settings->seconds, job.frames, job.written, wav_filename, wall_s,
+         wall_s > 0 ? settings->seconds / wall_s : 0.0);
+  return 0;
+}
+
+typedef struct stem_pool {
+  render_job jobs[STEM_MAX];
+  SDL_atomic_t next_job;
+} stem_pool;
+
+static int stem_worker(void *data) {
+  stem_pool *const pool = static_cast<stem_pool *>(data);
+  int i;
+  while ((i = SDL_AtomicAdd(&pool->next_job, 1)) < STEM_MAX)
+    render(&pool->jobs[i]);
+
+  return 0;
+}
+
+int run_stem_render(gambatte::GB *const gbs[], const char *wav_filename,
+                    const render_settings *settings) {
+  std::string base(wav_filename);
+  std::string extension(".wav");
+  std::string::size_type const dot = base.rfind('.');
+  if (dot != std::string::npos &&
+      (base.rfind('/') == std::string::npos || dot > base.rfind('/'))) {
+    extension = base.substr(dot);
+    base.erase(dot);
+  }
+
+  stem_pool pool;
+  SDL_AtomicSet(&pool.next_job, 0);
+  for (int i = 0; i < STEM_MAX; i++) {
+    pool.jobs[i].gb = gbs[i];
+    pool.jobs[i].filename = base + "-" + stem_names[i] + extension;
+    pool.jobs[i].channels = 0x11u << i;
+    pool.jobs[i].settings = settings;
+    pool.jobs[i].result = 1;
+  }
+
+  int threads = SDL_GetCPUCount();
+  if (threads > STEM_MAX)
+    threads = STEM_MAX;
+  if (threads < 1)
+    threads = 1;
+
+  Uint64 const start = SDL_GetPerformanceCounter();
+
+  // The calling thread is one of the workers
+  SDL_Thread *workers[STEM_MAX] = {NULL};
+  for (int i = 1; i < threads; i++)
+    workers[i] = SDL_CreateThread(stem_worker, "stems", &pool);
+  stem_worker(&pool);
+  for (int i = 1; i < threads; i++) {
+    if (workers[i] != NULL)
+      SDL_WaitThread(workers[i], NULL);
+  }
+
+  double const wall_s = seconds_since(start);
+  int result = 0;
+  for (int i = 0; i < STEM_MAX; i++) {
+    if (pool.jobs[i].result != 0)
+      result = pool.jobs[i].result;
+    else
+      printf("Rendered %s\n", pool.jobs[i].filename.c_str());
+  }
+
+  printf("Rendered %d stems of %ld s in %.1f s on %d threads, %.1fx "
+         "realtime\n",
+         STEM_MAX, settings->seconds, wall_s, threads,
+         wall_s > 0 ? STEM_MAX * settings->seconds / wall_s : 0.0);
+  return result;
+}
@@ -0,0 +1,39 @@
+#ifndef RENDER_H_
+#define RENDER_H_
+
+#include "gambatte.h"
+#include "inputscript.h"
+#include <cstddef>
+
+// APU channels, in the order of their bits in NR51
+typedef enum render_stem_t {
+  STEM_PULSE1,
+  STEM_PULSE2,
+  STEM_WAVE,
+  STEM_NOISE,
+  STEM_MAX
+} render_stem_t;
+
+typedef struct render_settings {
+  long seconds;     // emulated time to render
+  long sample_rate; // of the WAV file unless native
+  bool native;      // write the emulator's 2097152 Hz output as is
+  bool predecimate; // see ResampleChain
+  std::size_t resampler_index;
+  const input_script *script; // buttons to press, NULL for none
+} render_settings;
+
+// Runs the loaded ROM headlessly as fast as possible, writing its audio to
+// a WAV file.
+int run_render(gambatte::GB *gb, const char *wav_filename,
+               const render_settings *settings);
+
+// Renders each APU channel to its own WAV file, named like wav_filename
+// with -pulse1, -pulse2, -wave or -noise before the extension. gbs holds
+// STEM_MAX emulators in the same state, which run on as many threads as
+// there are cores. Emulation is deterministic, so the stems line up sample
+// for sample.
+int run_stem_render(gambatte::GB *const gbs[], const char *wav_filename,
+                    const render_settings *settings);
+
+#endif
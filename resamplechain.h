@@ -0,0 +1,52 @@
+#ifndef RESAMPLE_CHAIN_H_
+#define RESAMPLE_CHAIN_H_
+
+#include "decimator.h"
+#include "resample/resampler.h"
+#include "resample/resamplerinfo.h"
+#include <common/array.h>
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <cstddef>
+
+// The emulator's stereo output on its way to outRate: decimated by
+// Decimator::FACTOR if predecimate is set, then resampled.
+class ResampleChain {
+public:
+	enum { IN_RATE = 2097152 };
+
+	ResampleChain(long outRate, bool predecimate, ResamplerInfo const &resamplerInfo,
+	              std::size_t maxInSamples)
+	: decimator_(predecimate ? new Decimator(maxInSamples) : 0)
+	, decimateBuf_(predecimate ? Decimator::maxOut(maxInSamples) * 2 : 0)
+	, resampler_(resamplerInfo.create(predecimate ? IN_RATE / Decimator::FACTOR : IN_RATE,
+	                                  outRate, resamplerIn(predecimate, maxInSamples)))
+	{
+	}
+
+	Resampler & resampler() const { return *resampler_; }
+
+	std::size_t maxOut(std::size_t inSamples) const {
+		return resampler_->maxOut(resamplerIn(decimator_.get(), inSamples));
+	}
+
+	std::size_t resample(Sint16 *out, Sint16 const *in, std::size_t samples) {
+		if (decimator_.get()) {
+			samples = decimator_->decimate(decimateBuf_, in, samples);
+			in = decimateBuf_;
+		}
+
+		return resampler_->resample(out, in, samples);
+	}
+
+private:
+	scoped_ptr<Decimator> const decimator_;
+	Array<Sint16> const decimateBuf_;
+	scoped_ptr<Resampler> const resampler_;
+
+	static std::size_t resamplerIn(bool predecimate, std::size_t samples) {
+		return predecimate ? Decimator::maxOut(samples) : samples;
+	}
+};
+
+#endif
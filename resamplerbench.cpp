@@ -0,0 +1,329 @@
+#include "resamplerbench.h"
+#include "decimator.h"
+#include "gbframe.h"
+#include "resample/resampler.h"
+#include "resample/resamplerinfo.h"
+
+#include <common/array.h>
+#include <common/scoped_ptr.h>
+#include <malloc.h>
+#include <math.h>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// A quarter of a second of test tones
+static std::size_t const tone_samples = gb_sample_rate / 4;
+
+// Test tones as fractions of the output rate. The first ones should come
+// out unchanged, the others should be filtered out completely.
+static double const passed_tones[] = {0.01, 0.1, 0.35};
+static double const stopped_tones[] = {0.7, 1.6};
+static int const num_passed = sizeof passed_tones / sizeof *passed_tones;
+static int const num_stopped = sizeof stopped_tones / sizeof *stopped_tones;
+static double const tone_amplitude = 5000;
+
+typedef struct resampler_stats {
+  double ns_per_sample; // per emulator sample, decimation included
+  double cpu_share;     // of one core at realtime speed
+  long memory;          // peak heap bytes of the resampler, -1 if unknown
+  double sinad_db;      // signal to noise and distortion ratio
+} resampler_stats;
+
+#if defined(__GLIBC__)
+#define HEAP_PEAK_KNOWN 1
+
+// Counts heap bytes allocated through operator new while heap_watching is
+// set, and their high-water mark. Replacing operator new affects the whole
+// program, so it only counts while the benchmark has the process to itself.
+static bool heap_watching;
+static long heap_live;
+static long heap_peak;
+
+void *operator new(std::size_t size) {
+  void *const p = malloc(size ? size : 1);
+  if (p == NULL)
+    throw std::bad_alloc();
+
+  if (heap_watching) {
+    heap_live += malloc_usable_size(p);
+    if (heap_live > heap_peak)
+      heap_peak = heap_live;
+  }
+
+  return p;
+}
+
+void *operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void *p) noexcept {
+  if (p != NULL && heap_watching)
+    heap_live -= malloc_usable_size(p);
+
+  free(p);
+}
+
+void operator delete[](void *p) noexcept { operator delete(p); }
+void operator delete(void *p, std::size_t) noexcept { operator delete(p); }
+void operator delete[](void *p, std::size_t) noexcept { operator delete(p); }
+#else
+#define HEAP_PEAK_KNOWN 0
+static bool heap_watching;
+static long heap_live;
+static long heap_peak;
+#endif
+
+static void make_tones(Sint16 *out, long out_rate) {
+  for (std::size_t i = 0; i < tone_samples; i++) {
+    double const t = 2 * M_PI * i / gb_sample_rate;
+    double v = 0;
+    for (int k = 0; k < num_passed; k++)
+      v += tone_amplitude * sin(t * passed_tones[k] * out_rate);
+    for (int k = 0; k < num_stopped; k++)
+      v += tone_amplitude * sin(t * stopped_tones[k] * out_rate);
+
+    out[i * 2] = out[i * 2 + 1] = static_cast<Sint16>(floor(v + 0.5));
+  }
+}
+
+// Feeds stereo audio at the emulator's rate through the audio path with
+// resampler n a frame at a time, the way AudioOut does. Keeps up to
+// out_size output samples in out if it is not NULL. Returns the number of
+// output samples, with the time taken in ticks. memory and rate, if not
+// NULL, get the resampler's peak heap use (while it is created and while it
+// runs) and its exact output rate.
+static std::size_t run_resampler(std::size_t n, long out_rate,
+                                 bool predecimate, Sint16 const *in,
+                                 std::size_t samples, Sint16 *out,
+                                 std::size_t out_size, Uint64 *ticks,
+                                 long *memory, double *rate) {
+  std::size_t const chunk = gb_samples_per_frame;
+  scoped_ptr<Decimator> const decimator(predecimate ? new Decimator(chunk)
+                                                    : NULL);
+  std::size_t const period = predecimate ? Decimator::maxOut(chunk) : chunk;
+  Array<Sint16> const decimated(predecimate ? period * 2 : 0);
+  long const in_rate =
+      predecimate ? gb_sample_rate / Decimator::FACTOR : gb_sample_rate;
+
+  // The output buffer is the benchmark's, so it is left out of the count
+  heap_live = heap_peak = 0;
+  heap_watching = true;
+  scoped_ptr<Resampler> const resampler(
+      ResamplerInfo::get(n).create(in_rate, out_rate, period));
+  heap_watching = false;
+  Array<Sint16> const resampled(resampler->maxOut(period) * 2);
+  heap_watching = true;
+
+  std::size_t outsamples = 0;
+  Uint64 const start = SDL_GetPerformanceCounter();
+  for (std::size_t pos = 0; pos < samples; pos += chunk) {
+    std::size_t insamples = samples - pos < chunk ? samples - pos : chunk;
+    Sint16 const *resample_in = in + pos * 2;
+    if (decimator.get()) {
+      insamples = decimator->decimate(decimated, resample_in, insamples);
+      resample_in = decimated;
+    }
+
+    std::size_t const produced =
+        resampler->resample(resampled, resample_in, insamples);
+    if (out != NULL && outsamples < out_size) {
+      std::size_t const keep = out_size - outsamples < produced
+                                   ? out_size - outsamples
+                                   : produced;
+      memcpy(out + outsamples * 2, resampled, keep * 2 * sizeof *out);
+    }
+
+    outsamples += produced;
+  }
+
+  *ticks = SDL_GetPerformanceCounter() - start;
+  heap_watching = false;
+  if (memory != NULL)
+    *memory = HEAP_PEAK_KNOWN ? heap_peak : -1;
+  if (rate != NULL) {
+    unsigned long mul = 1, div = 1;
+    resampler->exactRatio(mul, div);
+    *rate = static_cast<double>(in_rate) * mul / div;
+  }
+
+  return outsamples;
+}
+
+// Solves the n by n system a x = b in place by Gaussian elimination
+static void solve(double *a, double *b, int n) {
+  for (int col = 0; col < n; col++) {
+    int pivot = col;
+    for (int row = col + 1; row < n; row++) {
+      if (fabs(a[row * n + col]) > fabs(a[pivot * n + col]))
+        pivot = row;
+    }
+
+    for (int k = 0; k < n; k++) {
+      double const t = a[col * n + k];
+      a[col * n + k] = a[pivot * n + k];
+      a[pivot * n + k] = t;
+    }
+
+    double const t = b[col];
+    b[col] = b[pivot];
+    b[pivot] = t;
+    if (a[col * n + col] == 0)
+      continue;
+
+    for (int row = col + 1; row < n; row++) {
+      double const f = a[row * n + col] / a[col * n + col];
+      for (int k = col; k < n; k++)
+        a[row * n + k] -= f * a[col * n + k];
+      b[row] -= f * b[col];
+    }
+  }
+
+  for (int col = n - 1; col >= 0; col--) {
+    for (int k = col + 1; k < n; k++)
+      b[col] -= a[col * n + k] * b[k];
+    b[col] = a[col * n + col] != 0 ? b[col] / a[col * n + col] : 0;
+  }
+}
+
+// Fits the passed tones (and DC) to the left channel of the resampler's
+// output by least squares, which takes care of the resampler's delay and
+// passband ripple. Whatever is left over is noise, distortion and aliased
+// stopped tones.
+static double measure_sinad(Sint16 const *out, std::size_t samples,
+                            long out_rate, double rate) {
+  enum { terms = 2 * sizeof passed_tones / sizeof *passed_tones + 1 };
+  // Skip the resampler settling in
+  std::size_t const first = samples / 4;
+  double a[terms * terms] = {0}, b[terms] = {0}, basis[terms];
+
+  for (int pass = 0; pass < 2; pass++) {
+    double signal = 0, noise = 0;
+    for (std::size_t i = first; i < samples; i++) {
+      double const t = 2 * M_PI * i / rate;
+      for (int k = 0; k < num_passed; k++) {
+        basis[k * 2] = sin(t * passed_tones[k] * out_rate);
+        basis[k * 2 + 1] = cos(t * passed_tones[k] * out_rate);
+      }
+      basis[terms - 1] = 1;
+
+      double const y = out[i * 2];
+      if (pass == 0) {
+        for (int j = 0; j < terms; j++) {
+          for (int k = 0; k < terms; k++)
+            a[j * terms + k] += basis[j] * basis[k];
+          b[j] += basis[j] * y;
+        }
+      } else {
+        double fit = 0;
+        for (int k = 0; k < terms - 1; k++)
+          fit += b[k] * basis[k];
+
+        signal += fit * fit;
+        noise += (y - fit - b[terms - 1]) * (y - fit - b[terms - 1]);
+      }
+    }
+
+    if (pass == 0)
+      solve(a, b, terms);
+    else if (noise > 0)
+      return 10 * log10(signal / noise);
+  }
+
+  return 200;
+}
+
+// Measures resampler n, timing it on audio or on the tones if audio is NULL
+static void measure_resampler(std::size_t n, long out_rate, bool predecimate,
+                              Sint16 const *tones, Sint16 const *audio,
+                              std::size_t samples, resampler_stats *stats) {
+  std::size_t const out_size =
+      static_cast<std::size_t>(tone_samples * (out_rate + 1.0) /
+                               gb_sample_rate) + 1;
+  Array<Sint16> const out(out_size * 2);
+  Uint64 ticks = 0;
+  double rate = out_rate;
+  std::size_t const outsamples =
+      run_resampler(n, out_rate, predecimate, tones, tone_samples, out,
+                    out_size, &ticks, &stats->memory, &rate);
+  stats->sinad_db = measure_sinad(out, outsamples < out_size ? outsamples
+                                                             : out_size,
+                                  out_rate, rate);
+
+  if (audio == NULL) {
+    audio = tones;
+    samples = tone_samples;
+  }
+
+  // Best of a few runs, to keep other load out of the numbers
+  Uint64 best = 0;
+  for (int run = 0; run < 3; run++) {
+    run_resampler(n, out_rate, predecimate, audio, samples, NULL, 0, &ticks,
+                  NULL, NULL);
+    if (run == 0 || ticks < best)
+      best = ticks;
+  }
+
+  stats->ns_per_sample = best * 1e9 / SDL_GetPerformanceFrequency() / samples;
+  stats->cpu_share = stats->ns_per_sample * gb_sample_rate / 1e9;
+}
+
+static std::size_t pick(resampler_stats const *stats, double cpu_budget) {
+  std::size_t best = 0, cheapest = 0;
+  bool fits = false;
+  for (std::size_t i = 0; i < ResamplerInfo::num(); i++) {
+    if (stats[i].cpu_share < stats[cheapest].cpu_share)
+      cheapest = i;
+
+    if (stats[i].cpu_share <= cpu_budget &&
+        (!fits || stats[i].sinad_db > stats[best].sinad_db)) {
+      best = i;
+      fits = true;
+    }
+  }
+
+  return fits ? best : cheapest;
+}
+
+std::size_t pick_resampler(long out_rate, bool predecimate,
+                           double cpu_budget) {
+  Array<Sint16> const tones(tone_samples * 2);
+  Array<resampler_stats> const stats(ResamplerInfo::num());
+  make_tones(tones, out_rate);
+
+  for (std::size_t i = 0; i < ResamplerInfo::num(); i++)
+    measure_resampler(i, out_rate, predecimate, tones, NULL, 0, &stats[i]);
+
+  std::size_t const n = pick(stats, cpu_budget);
+  SDL_Log("Resampler: %s, %.2f%% CPU, %.1f dB SINAD",
+          ResamplerInfo::get(n).desc, stats[n].cpu_share * 100,
+          stats[n].sinad_db);
+  return n;
+}
+
+void print_resampler_table(long out_rate, bool predecimate, double cpu_budget,
+                           Sint16 const *audio, std::size_t samples) {
+  Array<Sint16> const tones(tone_samples * 2);
+  Array<resampler_stats> const stats(ResamplerInfo::num());
+  make_tones(tones, out_rate);
+
+  for (std::size_t i = 0; i < ResamplerInfo::num(); i++)
+    measure_resampler(i, out_rate, predecimate, tones, audio, samples,
+                      &stats[i]);
+
+  std::size_t const picked = pick(stats, cpu_budget);
+  printf("Resamplers at %ld Hz, %.1f%% CPU budget:\n", out_rate,
+         cpu_budget * 100);
+  printf("  %-2s %-36s %9s %7s %9s %9s\n", "#", "description", "ns/sample",
+         "CPU", "memory", "SINAD");
+  for (std::size_t i = 0; i < ResamplerInfo::num(); i++) {
+    char memory[16] = "n/a";
+    if (stats[i].memory >= 0)
+      snprintf(memory, sizeof memory, "%ld KB", (stats[i].memory + 512) / 1024);
+
+    printf("  %-2u %-36s %9.2f %6.2f%% %9s %6.1f dB%s\n",
+           static_cast<unsigned>(i), ResamplerInfo::get(i).desc,
+           stats[i].ns_per_sample, stats[i].cpu_share * 100, memory,
+           stats[i].sinad_db, i == picked ? "  <- auto" : "");
+  }
+}
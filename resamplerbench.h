@@ -0,0 +1,19 @@
+#ifndef RESAMPLER_BENCH_H_
+#define RESAMPLER_BENCH_H_
+
+#include <SDL.h>
+#include <cstddef>
+
+// Picks the ResamplerInfo entry with the best measured quality that takes
+// at most cpu_budget (a fraction of one core) to resample the emulator's
+// audio to out_rate in realtime on this machine, or the cheapest one if
+// none fits. Takes a few tens of milliseconds.
+std::size_t pick_resampler(long out_rate, bool predecimate, double cpu_budget);
+
+// Prints the speed, memory use and quality of every resampler. Speed is
+// measured on the given stereo audio at the emulator's rate, quality on
+// test tones since it needs a known reference.
+void print_resampler_table(long out_rate, bool predecimate, double cpu_budget,
+                           Sint16 const *audio, std::size_t samples);
+
+#endif
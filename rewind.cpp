@@ -0,0 +1,213 @@
+#include "rewind.h"
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Runs of unchanged bytes shorter than this are stored along with the
+// changed bytes around them, which keeps the encoding from growing past the
+// input size plus a few bytes
+std::size_t const min_run = 8;
+
+// Leaves room for the two run lengths that can end an encoding
+std::size_t const max_overhead = 2 * 10;
+
+// The history index holds at most one entry per this many arena bytes
+std::size_t const min_entry_size = 64;
+
+char * putLength(char *out, std::size_t n) {
+	while (n >= 0x80) {
+		*out++ = static_cast<char>(n | 0x80);
+		n >>= 7;
+	}
+
+	*out++ = static_cast<char>(n);
+	return out;
+}
+
+char const * getLength(char const *in, char const *const end, std::size_t &n) {
+	n = 0;
+	for (unsigned shift = 0; in != end; shift += 7) {
+		unsigned char const c = *in++;
+		n |= static_cast<std::size_t>(c & 0x7f) << shift;
+		if (!(c & 0x80))
+			return in;
+	}
+
+	return 0;
+}
+
+std::size_t sameBytes(unsigned char const *a, unsigned char const *b, std::size_t n) {
+	std::size_t i = 0;
+	for (; i + 8 <= n; i += 8) {
+		if (std::memcmp(a + i, b + i, 8))
+			break;
+	}
+
+	while (i < n && a[i] == b[i])
+		++i;
+
+	return i;
+}
+
+// Encodes the difference between a and b as pairs of run lengths, unchanged
+// bytes followed by changed bytes, with the changed bytes as a XOR b.
+// Save states of consecutive frames mostly differ in a few places, so this
+// shrinks them to a small fraction of their size at memory bandwidth.
+std::size_t encodeDelta(char *const out, char const *const a, char const *const b,
+                        std::size_t const size)
+{
+	unsigned char const *const ua = reinterpret_cast<unsigned char const *>(a);
+	unsigned char const *const ub = reinterpret_cast<unsigned char const *>(b);
+	char *o = out;
+	std::size_t pos = 0;
+
+	while (pos < size) {
+		std::size_t const same = sameBytes(ua + pos, ub + pos, size - pos);
+		pos += same;
+
+		std::size_t const changedStart = pos;
+		std::size_t changedEnd = size;
+		while (pos < size) {
+			if (ua[pos] != ub[pos]) {
+				++pos;
+				continue;
+			}
+
+			std::size_t const run = sameBytes(ua + pos, ub + pos, std::min(min_run, size - pos));
+			if (run == min_run) {
+				changedEnd = pos;
+				break;
+			}
+
+			pos += run;
+		}
+
+		pos = changedEnd;
+		o = putLength(o, same);
+		o = putLength(o, changedEnd - changedStart);
+		for (std::size_t i = changedStart; i < changedEnd; ++i)
+			*o++ = a[i] ^ b[i];
+	}
+
+	return o - out;
+}
+
+// XORs an encoded difference into state. Returns false if it does not fit.
+bool applyDelta(char *const state, std::size_t const size,
+                char const *in, std::size_t const deltaSize)
+{
+	char const *const end = in + deltaSize;
+	std::size_t pos = 0;
+
+	while (in != end) {
+		std::size_t same = 0, changed = 0;
+		if (!(in = getLength(in, end, same)) || !(in = getLength(in, end, changed)))
+			return false;
+		if (same > size - pos || changed > size - pos - same
+				|| changed > static_cast<std::size_t>(end - in)) {
+			return false;
+		}
+
+		pos += same;
+		for (std::size_t i = 0; i < changed; ++i)
+			state[pos++] ^= *in++;
+	}
+
+	return true;
+}
+
+} // anon ns
+
+Rewind::Rewind(std::size_t const arenaSize, int const interval)
+: arena_(arenaSize)
+, entries_(arenaSize / min_entry_size + 1)
+, first_(0)
+, count_(0)
+, head_(0)
+, interval_(interval)
+, counter_(0)
+{
+}
+
+void Rewind::reset() {
+	first_ = count_ = head_ = 0;
+	counter_ = 0;
+	state_.reset();
+	newest_.reset();
+	delta_.reset();
+}
+
+void Rewind::frame(gambatte::GB &gb) {
+	if (++counter_ < interval_ && newest_.size())
+		return;
+
+	counter_ = 0;
+	if (!state_.save(gb))
+		return;
+
+	std::size_t const size = state_.size();
+	if (newest_.size() != size) {
+		// First capture, or the core changed its state size
+		first_ = count_ = head_ = 0;
+		newest_.reset(size);
+		delta_.reset(size + max_overhead);
+	} else {
+		// Store how to get from the new state back to the previous one
+		push(delta_, encodeDelta(delta_, state_.data(), newest_, size));
+	}
+
+	std::memcpy(newest_, state_.data(), size);
+}
+
+void Rewind::push(char const *const data, std::size_t const size) {
+	if (size > arena_.size()) {
+		// The chain back to older states would be broken without this entry
+		first_ = count_ = head_ = 0;
+		return;
+	}
+
+	if (count_ == entries_.size())
+		dropOldest();
+
+	if (!count_) {
+		head_ = 0;
+	} else if (head_ + size > arena_.size()) {
+		// Entries past the end of the newest one are the oldest
+		while (count_ && entry(0).offset >= head_)
+			dropOldest();
+
+		head_ = 0;
+	}
+
+	while (count_ && entry(0).offset < head_ + size
+			&& entry(0).offset + entry(0).size > head_) {
+		dropOldest();
+	}
+
+	Entry &e = entry(count_++);
+	e.offset = head_;
+	e.size = size;
+	std::memcpy(arena_ + head_, data, size);
+	head_ += size;
+}
+
+bool Rewind::stepBack(gambatte::GB &gb) {
+	if (!newest_.size())
+		return false;
+
+	if (!counter_ && count_) {
+		Entry const &e = entry(count_ - 1);
+		if (!applyDelta(newest_, newest_.size(), arena_ + e.offset, e.size)) {
+			reset();
+			return false;
+		}
+
+		--count_;
+		head_ = count_ ? e.offset : 0;
+	}
+
+	// Running a frame from here counts towards the next capture again
+	counter_ = 0;
+	return gb.loadState(newest_, newest_.size());
+}
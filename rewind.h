@@ -0,0 +1,53 @@
+#ifndef REWIND_H_
+#define REWIND_H_
+
+#include "gambatte.h"
+#include "statebuffer.h"
+#include <common/array.h>
+#include <cstddef>
+
+// Rolling history of save states for rewinding. A state is captured every
+// few frames. Only the newest state is kept whole; each older one is stored
+// in a fixed size arena as the compressed difference to the state after it,
+// so stepping back undoes one difference at a time and the oldest entries
+// can be dropped without re-encoding anything.
+class Rewind {
+public:
+	Rewind(std::size_t arenaSize, int interval);
+
+	// Call after every emulated frame. Captures a state every interval frames.
+	void frame(gambatte::GB &gb);
+
+	// Loads the newest state in the history if the emulator has run since it
+	// was captured, otherwise the one before it. At the oldest state, loads it
+	// again. Returns false if there is nothing to load.
+	bool stepBack(gambatte::GB &gb);
+
+	// Number of states that can be reached by stepping back
+	std::size_t states() const { return newest_.size() ? count_ + 1 : 0; }
+
+	void reset();
+
+private:
+	struct Entry {
+		std::size_t offset;
+		std::size_t size;
+	};
+
+	Array<char> const arena_;
+	Array<Entry> const entries_;
+	std::size_t first_;
+	std::size_t count_;
+	std::size_t head_;
+	StateBuffer state_;
+	Array<char> newest_;
+	Array<char> delta_;
+	int const interval_;
+	int counter_;
+
+	Entry & entry(std::size_t i) const { return entries_[(first_ + i) % entries_.size()]; }
+	void push(char const *data, std::size_t size);
+	void dropOldest() { first_ = (first_ + 1) % entries_.size(); --count_; }
+};
+
+#endif
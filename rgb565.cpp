@@ -0,0 +1,56 @@
+#include "rgb565.h"
+
+#if defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define RGB565_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define RGB565_NEON 1
+#endif
+
+static inline Uint16 to_rgb565(gambatte::uint_least32_t p) {
+  return (p >> 8 & 0xF800) | (p >> 5 & 0x07E0) | (p >> 3 & 0x001F);
+}
+
+#ifdef RGB565_SSE2
+static inline __m128i to_rgb565_sse2(__m128i p) {
+  __m128i const v = _mm_or_si128(
+      _mm_or_si128(_mm_and_si128(_mm_srli_epi32(p, 8), _mm_set1_epi32(0xF800)),
+                   _mm_and_si128(_mm_srli_epi32(p, 5), _mm_set1_epi32(0x07E0))),
+      _mm_and_si128(_mm_srli_epi32(p, 3), _mm_set1_epi32(0x001F)));
+
+  // Sign extend so the signed saturating pack keeps all 16 bits
+  return _mm_srai_epi32(_mm_slli_epi32(v, 16), 16);
+}
+#endif
+
+void convert_rgb565(Uint16 *dst, gambatte::uint_least32_t const *src,
+                    int width) {
+  int x = 0;
+
+#if defined(RGB565_SSE2)
+  for (; x + 8 <= width; x += 8) {
+    __m128i const lo = to_rgb565_sse2(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + x)));
+    __m128i const hi = to_rgb565_sse2(
+        _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + x + 4)));
+    _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x),
+                     _mm_packs_epi32(lo, hi));
+  }
+#elif defined(RGB565_NEON)
+  for (; x + 8 <= width; x += 8) {
+    uint32x4_t const lo = vld1q_u32(src + x);
+    uint32x4_t const hi = vld1q_u32(src + x + 4);
+    uint16x8_t const r = vcombine_u16(vshrn_n_u32(lo, 8), vshrn_n_u32(hi, 8));
+    uint16x8_t const g = vcombine_u16(vshrn_n_u32(lo, 5), vshrn_n_u32(hi, 5));
+    uint16x8_t const b = vcombine_u16(vshrn_n_u32(lo, 3), vshrn_n_u32(hi, 3));
+    uint16x8_t v = vandq_u16(r, vdupq_n_u16(0xF800));
+    v = vorrq_u16(v, vandq_u16(g, vdupq_n_u16(0x07E0)));
+    v = vorrq_u16(v, vandq_u16(b, vdupq_n_u16(0x001F)));
+    vst1q_u16(dst + x, v);
+  }
+#endif
+
+  for (; x < width; x++)
+    dst[x] = to_rgb565(src[x]);
+}
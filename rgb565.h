@@ -0,0 +1,11 @@
+#ifndef RGB565_H_
+#define RGB565_H_
+
+#include "gbint.h"
+#include <SDL.h>
+
+// Converts width xRGB8888 pixels to RGB565, using SSE2 or NEON where
+// available.
+void convert_rgb565(Uint16 *dst, gambatte::uint_least32_t const *src, int width);
+
+#endif
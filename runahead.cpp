@@ -0,0 +1,23 @@
+#include "runahead.h"
+#include "gbframe.h"
+
+RunAhead::RunAhead(int const frames, std::size_t const maxSamplesPerRun)
+: frames_(frames)
+, audioBuf_(maxSamplesPerRun)
+{
+}
+
+bool RunAhead::run(gambatte::GB &gb, gambatte::uint_least32_t *const videoBuf,
+                   std::ptrdiff_t const pitch)
+{
+	if (!state_.save(gb))
+		return false;
+
+	for (int frames = 0; frames < frames_;) {
+		std::size_t samples = gb_samples_per_frame;
+		if (gb.runFor(videoBuf, pitch, audioBuf_, samples) >= 0)
+			++frames;
+	}
+
+	return state_.load(gb);
+}
@@ -0,0 +1,30 @@
+#ifndef RUN_AHEAD_H_
+#define RUN_AHEAD_H_
+
+#include "gambatte.h"
+#include "statebuffer.h"
+#include <common/array.h>
+#include <cstddef>
+
+// Hides input latency by showing a frame from the future. After each frame
+// on the canonical timeline, the emulator is run a few frames further with
+// the current input, the last of those frames is kept for display, and the
+// machine is rolled back. Audio produced while running ahead is discarded,
+// so only the canonical timeline is heard.
+class RunAhead {
+public:
+	RunAhead(int frames, std::size_t maxSamplesPerRun);
+
+	int frames() const { return frames_; }
+
+	// Runs ahead from the current state, leaving the last frame in videoBuf.
+	// Returns false if the state could not be saved or restored.
+	bool run(gambatte::GB &gb, gambatte::uint_least32_t *videoBuf, std::ptrdiff_t pitch);
+
+private:
+	int const frames_;
+	Array<gambatte::uint_least32_t> const audioBuf_;
+	StateBuffer state_;
+};
+
+#endif
@@ -0,0 +1,70 @@
+#include "safefile.h"
+#include <cerrno>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+bool writeAll(int const fd, char const *data, std::size_t size) {
+	while (size) {
+		ssize_t const n = write(fd, data, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return false;
+
+		data += n;
+		size -= n;
+	}
+
+	return true;
+}
+
+// Makes a rename in the directory of filename durable
+void syncDir(std::string const &filename) {
+	std::string::size_type const slash = filename.rfind('/');
+	std::string const dir = slash == std::string::npos ? "." : filename.substr(0, slash + 1);
+	int const fd = open(dir.c_str(), O_RDONLY);
+	if (fd >= 0) {
+		fsync(fd);
+		close(fd);
+	}
+}
+
+} // anon ns
+
+bool writeFileSafely(std::string const &filename, void const *const data, std::size_t const size) {
+	std::string const tmpname = filename + ".tmp";
+	int const fd = open(tmpname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return false;
+
+	bool const ok = writeAll(fd, static_cast<char const *>(data), size) && fsync(fd) == 0;
+	if (close(fd) != 0 || !ok || std::rename(tmpname.c_str(), filename.c_str()) != 0) {
+		std::remove(tmpname.c_str());
+		return false;
+	}
+
+	syncDir(filename);
+	return true;
+}
+
+bool readFile(std::string const &filename, Array<char> &data) {
+	std::FILE *const file = std::fopen(filename.c_str(), "rb");
+	if (!file)
+		return false;
+
+	long size = -1;
+	if (std::fseek(file, 0, SEEK_END) == 0)
+		size = std::ftell(file);
+
+	bool ok = size >= 0 && std::fseek(file, 0, SEEK_SET) == 0;
+	if (ok) {
+		data.reset(size);
+		ok = std::fread(data, 1, size, file) == std::size_t(size);
+	}
+
+	std::fclose(file);
+	return ok;
+}
@@ -0,0 +1,17 @@
+#ifndef SAFE_FILE_H_
+#define SAFE_FILE_H_
+
+#include <common/array.h>
+#include <cstddef>
+#include <string>
+
+// Replaces the contents of filename with data so that after a crash or power
+// loss the file holds either the old or the new contents, never a mix. The
+// data goes to a temporary file that is synced before it is renamed over
+// filename. Blocks until the data is on disk.
+bool writeFileSafely(std::string const &filename, void const *data, std::size_t size);
+
+// Reads all of filename into data. Returns false if it cannot be read.
+bool readFile(std::string const &filename, Array<char> &data);
+
+#endif
@@ -0,0 +1,334 @@
+#include "scaler.h"
+#include <SDL.h>
+#include <algorithm>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SCALER_SSE2 1
+#endif
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCALER_AVX2 1
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define SCALER_NEON 1
+#endif
+
+using gambatte::uint_least32_t;
+
+namespace {
+
+typedef void (*RowScaler)(uint_least32_t *dst, uint_least32_t const *src, int width);
+
+template<int factor>
+static void scaleRowGeneric(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	for (int x = 0; x < width; ++x) {
+		for (int i = 0; i < factor; ++i)
+			dst[i] = src[x];
+
+		dst += factor;
+	}
+}
+
+#ifdef SCALER_SSE2
+
+static void scaleRow2xSse2(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i const p = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + x));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 2), _mm_unpacklo_epi32(p, p));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x * 2 + 4), _mm_unpackhi_epi32(p, p));
+	}
+
+	scaleRowGeneric<2>(dst + x * 2, src + x, width - x);
+}
+
+static void scaleRow3xSse2(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i const p = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + x));
+		__m128i *const d = reinterpret_cast<__m128i *>(dst + x * 3);
+		_mm_storeu_si128(d, _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 0, 0, 0)));
+		_mm_storeu_si128(d + 1, _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 1, 1)));
+		_mm_storeu_si128(d + 2, _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 2)));
+	}
+
+	scaleRowGeneric<3>(dst + x * 3, src + x, width - x);
+}
+
+static void scaleRow4xSse2(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		__m128i const p = _mm_loadu_si128(reinterpret_cast<__m128i const *>(src + x));
+		__m128i *const d = reinterpret_cast<__m128i *>(dst + x * 4);
+		_mm_storeu_si128(d, _mm_shuffle_epi32(p, _MM_SHUFFLE(0, 0, 0, 0)));
+		_mm_storeu_si128(d + 1, _mm_shuffle_epi32(p, _MM_SHUFFLE(1, 1, 1, 1)));
+		_mm_storeu_si128(d + 2, _mm_shuffle_epi32(p, _MM_SHUFFLE(2, 2, 2, 2)));
+		_mm_storeu_si128(d + 3, _mm_shuffle_epi32(p, _MM_SHUFFLE(3, 3, 3, 3)));
+	}
+
+	scaleRowGeneric<4>(dst + x * 4, src + x, width - x);
+}
+
+#endif
+
+#ifdef SCALER_AVX2
+
+__attribute__((target("avx2")))
+static void scaleRow2xAvx2(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	__m256i const lo = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+	__m256i const hi = _mm256_setr_epi32(4, 4, 5, 5, 6, 6, 7, 7);
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256i const p = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + x));
+		__m256i *const d = reinterpret_cast<__m256i *>(dst + x * 2);
+		_mm256_storeu_si256(d, _mm256_permutevar8x32_epi32(p, lo));
+		_mm256_storeu_si256(d + 1, _mm256_permutevar8x32_epi32(p, hi));
+	}
+
+	scaleRowGeneric<2>(dst + x * 2, src + x, width - x);
+}
+
+__attribute__((target("avx2")))
+static void scaleRow4xAvx2(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 8 <= width; x += 8) {
+		__m256i const p = _mm256_loadu_si256(reinterpret_cast<__m256i const *>(src + x));
+		__m256i *const d = reinterpret_cast<__m256i *>(dst + x * 4);
+		for (int i = 0; i < 4; ++i) {
+			__m256i const idx = _mm256_setr_epi32(i * 2, i * 2, i * 2, i * 2,
+			                                      i * 2 + 1, i * 2 + 1, i * 2 + 1, i * 2 + 1);
+			_mm256_storeu_si256(d + i, _mm256_permutevar8x32_epi32(p, idx));
+		}
+	}
+
+	scaleRowGeneric<4>(dst + x * 4, src + x, width - x);
+}
+
+#endif
+
+#ifdef SCALER_NEON
+
+static void scaleRow2xNeon(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		uint32x4_t const p = vld1q_u32(src + x);
+		uint32x4x2_t const d = { { p, p } };
+		vst2q_u32(dst + x * 2, d);
+	}
+
+	scaleRowGeneric<2>(dst + x * 2, src + x, width - x);
+}
+
+static void scaleRow3xNeon(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		uint32x4_t const p = vld1q_u32(src + x);
+		uint32x4x3_t const d = { { p, p, p } };
+		vst3q_u32(dst + x * 3, d);
+	}
+
+	scaleRowGeneric<3>(dst + x * 3, src + x, width - x);
+}
+
+static void scaleRow4xNeon(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	int x = 0;
+	for (; x + 4 <= width; x += 4) {
+		uint32x4_t const p = vld1q_u32(src + x);
+		uint32x4x4_t const d = { { p, p, p, p } };
+		vst4q_u32(dst + x * 4, d);
+	}
+
+	scaleRowGeneric<4>(dst + x * 4, src + x, width - x);
+}
+
+#endif
+
+static void scaleRow1x(uint_least32_t *dst, uint_least32_t const *src, int width) {
+	std::memcpy(dst, src, width * sizeof *dst);
+}
+
+static RowScaler rowScaler(int factor) {
+	switch (factor) {
+	case 1: return scaleRow1x;
+	case 2:
+#ifdef SCALER_AVX2
+		if (SDL_HasAVX2())
+			return scaleRow2xAvx2;
+#endif
+#if defined(SCALER_SSE2)
+		return scaleRow2xSse2;
+#elif defined(SCALER_NEON)
+		return scaleRow2xNeon;
+#else
+		return scaleRowGeneric<2>;
+#endif
+	case 3:
+#if defined(SCALER_SSE2)
+		return scaleRow3xSse2;
+#elif defined(SCALER_NEON)
+		return scaleRow3xNeon;
+#else
+		return scaleRowGeneric<3>;
+#endif
+	case 4:
+#ifdef SCALER_AVX2
+		if (SDL_HasAVX2())
+			return scaleRow4xAvx2;
+#endif
+#if defined(SCALER_SSE2)
+		return scaleRow4xSse2;
+#elif defined(SCALER_NEON)
+		return scaleRow4xNeon;
+#else
+		return scaleRowGeneric<4>;
+#endif
+	case 5: return scaleRowGeneric<5>;
+	}
+
+	return scaleRowGeneric<6>;
+}
+
+// Scales each row horizontally, then repeats it factor times.
+static void scaleNearest(uint_least32_t *dst, std::ptrdiff_t dstPitch,
+                         uint_least32_t const *src, std::ptrdiff_t srcPitch,
+                         int width, int height, int factor)
+{
+	RowScaler const scaleRow = rowScaler(factor);
+	for (int y = 0; y < height; ++y) {
+		scaleRow(dst, src, width);
+		for (int i = 1; i < factor; ++i)
+			std::memcpy(dst + i * dstPitch, dst, width * factor * sizeof *dst);
+
+		dst += dstPitch * factor;
+		src += srcPitch;
+	}
+}
+
+// Scale2x (AdvanceMAME2x). Edges are handled by repeating border pixels.
+static void scale2x(uint_least32_t *dst, std::ptrdiff_t dstPitch,
+                    uint_least32_t const *src, std::ptrdiff_t srcPitch,
+                    int width, int height)
+{
+	for (int y = 0; y < height; ++y) {
+		uint_least32_t const *const up = src - (y > 0 ? srcPitch : 0);
+		uint_least32_t const *const down = src + (y < height - 1 ? srcPitch : 0);
+		uint_least32_t *const d0 = dst;
+		uint_least32_t *const d1 = dst + dstPitch;
+
+		for (int x = 0; x < width; ++x) {
+			int const l = x > 0 ? x - 1 : x;
+			int const r = x < width - 1 ? x + 1 : x;
+			uint_least32_t const b = up[x], d = src[l], e = src[x], f = src[r], h = down[x];
+
+			if (b != h && d != f) {
+				d0[x * 2] = d == b ? d : e;
+				d0[x * 2 + 1] = b == f ? f : e;
+				d1[x * 2] = d == h ? d : e;
+				d1[x * 2 + 1] = h == f ? f : e;
+			} else {
+				d0[x * 2] = d0[x * 2 + 1] = d1[x * 2] = d1[x * 2 + 1] = e;
+			}
+		}
+
+		dst += dstPitch * 2;
+		src += srcPitch;
+	}
+}
+
+// Scale3x (AdvanceMAME3x). Edges are handled by repeating border pixels.
+static void scale3x(uint_least32_t *dst, std::ptrdiff_t dstPitch,
+                    uint_least32_t const *src, std::ptrdiff_t srcPitch,
+                    int width, int height)
+{
+	for (int y = 0; y < height; ++y) {
+		uint_least32_t const *const up = src - (y > 0 ? srcPitch : 0);
+		uint_least32_t const *const down = src + (y < height - 1 ? srcPitch : 0);
+		uint_least32_t *const d0 = dst;
+		uint_least32_t *const d1 = dst + dstPitch;
+		uint_least32_t *const d2 = dst + dstPitch * 2;
+
+		for (int x = 0; x < width; ++x) {
+			int const l = x > 0 ? x - 1 : x;
+			int const r = x < width - 1 ? x + 1 : x;
+			uint_least32_t const a = up[l], b = up[x], c = up[r];
+			uint_least32_t const d = src[l], e = src[x], f = src[r];
+			uint_least32_t const g = down[l], h = down[x], i = down[r];
+
+			if (b != h && d != f) {
+				d0[x * 3] = d == b ? d : e;
+				d0[x * 3 + 1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+				d0[x * 3 + 2] = b == f ? f : e;
+				d1[x * 3] = (d == b && e != g) || (d == h && e != a) ? d : e;
+				d1[x * 3 + 1] = e;
+				d1[x * 3 + 2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+				d2[x * 3] = d == h ? d : e;
+				d2[x * 3 + 1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+				d2[x * 3 + 2] = h == f ? f : e;
+			} else {
+				d0[x * 3] = d0[x * 3 + 1] = d0[x * 3 + 2] = e;
+				d1[x * 3] = d1[x * 3 + 1] = d1[x * 3 + 2] = e;
+				d2[x * 3] = d2[x * 3 + 1] = d2[x * 3 + 2] = e;
+			}
+		}
+
+		dst += dstPitch * 3;
+		src += srcPitch;
+	}
+}
+
+static int scalexFactor(int factor, Scaler::Filter filter) {
+	if (filter != Scaler::SCALEX)
+		return 1;
+	if (factor % 3 == 0)
+		return 3;
+	if (factor % 2 == 0)
+		return 2;
+
+	return 1;
+}
+
+} // anon ns
+
+Scaler::Scaler(int const width, int const height, int const factor, Filter const filter)
+: width_(width)
+, height_(height)
+, factor_(std::max(1, std::min<int>(factor, MAX_FACTOR)))
+, scalexFactor_(scalexFactor(factor_, filter))
+, tmp_(scalexFactor_ > 1 && scalexFactor_ < factor_
+       ? std::size_t(width) * height * scalexFactor_ * scalexFactor_
+       : 0)
+{
+}
+
+void Scaler::scale(uint_least32_t *const dst, std::ptrdiff_t const dstPitch,
+                   uint_least32_t const *const src, std::ptrdiff_t const srcPitch)
+{
+	if (scalexFactor_ == 1) {
+		scaleNearest(dst, dstPitch, src, srcPitch, width_, height_, factor_);
+		return;
+	}
+
+	// ScaleX straight into dst, or into tmp_ followed by a nearest pass
+	bool const direct = scalexFactor_ == factor_;
+	uint_least32_t *const out = direct ? dst : tmp_.get();
+	std::ptrdiff_t const outPitch = direct ? dstPitch : std::ptrdiff_t(width_) * scalexFactor_;
+
+	if (scalexFactor_ == 3)
+		scale3x(out, outPitch, src, srcPitch, width_, height_);
+	else
+		scale2x(out, outPitch, src, srcPitch, width_, height_);
+
+	if (!direct) {
+		scaleNearest(dst, dstPitch, out, outPitch, width_ * scalexFactor_,
+		             height_ * scalexFactor_, factor_ / scalexFactor_);
+	}
+}
+
+char const * Scaler::filterName(Filter const filter) {
+	return filter == SCALEX ? "scalex" : "nearest";
+}
@@ -0,0 +1,36 @@
+#ifndef SCALER_H_
+#define SCALER_H_
+
+#include "gbint.h"
+#include <common/array.h>
+#include <cstddef>
+
+// Integer frame scaler used when SDL would otherwise do the scaling in
+// software. Nearest neighbour scaling uses SSE2/AVX2 or NEON kernels where
+// available. The ScaleX filter applies Scale2x or Scale3x to the frame and
+// scales the result by the remaining factor with nearest neighbour.
+class Scaler {
+public:
+	enum Filter { NEAREST, SCALEX };
+	enum { MAX_FACTOR = 6 };
+
+	Scaler(int width, int height, int factor, Filter filter);
+
+	int factor() const { return factor_; }
+
+	// Scales a width x height frame into dst, which must hold
+	// width * factor() x height * factor() pixels. Pitches are in pixels.
+	void scale(gambatte::uint_least32_t *dst, std::ptrdiff_t dstPitch,
+	           gambatte::uint_least32_t const *src, std::ptrdiff_t srcPitch);
+
+	static char const * filterName(Filter filter);
+
+private:
+	int const width_;
+	int const height_;
+	int const factor_;
+	int const scalexFactor_;
+	Array<gambatte::uint_least32_t> const tmp_;
+};
+
+#endif
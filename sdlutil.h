@@ -0,0 +1,24 @@
+#ifndef SDL_UTIL_H_
+#define SDL_UTIL_H_
+
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+
+// Destroys SDL objects owned by a scoped_ptr<T, SdlDeleter>
+struct SdlDeleter {
+	static void del(SDL_mutex *m) { SDL_DestroyMutex(m); }
+	static void del(SDL_cond *c) { SDL_DestroyCond(c); }
+	static void del(SDL_sem *s) { SDL_DestroySemaphore(s); }
+};
+
+// Holds a mutex locked for the lifetime of the guard
+class LockGuard {
+public:
+	explicit LockGuard(SDL_mutex *m) : m_(m) { SDL_mutexP(m); }
+private:
+	struct LockDeleter { static void del(SDL_mutex *m) { SDL_mutexV(m); } };
+	scoped_ptr<SDL_mutex, LockDeleter> const m_;
+};
+
+#endif
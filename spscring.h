@@ -0,0 +1,114 @@
+#ifndef SPSC_RING_H_
+#define SPSC_RING_H_
+
+#include <common/array.h>
+#include <SDL.h>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+
+// Wait-free single producer, single consumer ring buffer. Each side only
+// stores its own position and loads the other's, so neither ever waits for
+// the other. Positions run over twice the ring size to tell a full ring
+// from an empty one. They are kept on separate cache lines so the two
+// threads do not keep stealing the same line from each other.
+template<typename T>
+class SpscRing {
+public:
+	explicit SpscRing(std::size_t size)
+	: buf_(size), size_(size)
+	{
+		SDL_AtomicSet(&readPos_, 0);
+		SDL_AtomicSet(&writePos_, 0);
+	}
+
+	std::size_t size() const { return size_; }
+
+	// Either side. A snapshot that may be outdated by the time it is used,
+	// but only in the safe direction for the side asking.
+	std::size_t used() const { return distance(load(readPos_), load(writePos_)); }
+	std::size_t avail() const { return size_ - used(); }
+
+	// Producer side. Writes up to num items, returning how many were written.
+	std::size_t write(T const *in, std::size_t num) {
+		std::size_t const wpos = load(writePos_);
+		num = std::min(num, size_ - distance(load(readPos_), wpos));
+		std::size_t const i = index(wpos), first = std::min(num, size_ - i);
+		std::memcpy(buf_ + i, in, first * sizeof *in);
+		std::memcpy(buf_, in + first, (num - first) * sizeof *in);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&writePos_, advance(wpos, num));
+		return num;
+	}
+
+	// Producer side. Free room in the ring, as up to two spans: the second
+	// one starts at the beginning of the ring if the room wraps around.
+	// Items put there become visible to the consumer with commit.
+	struct Spans {
+		T *first;
+		std::size_t firstSize;
+		T *second;
+		std::size_t secondSize;
+	};
+
+	Spans reserve(std::size_t max) {
+		std::size_t const wpos = load(writePos_);
+		std::size_t const num = std::min(max, size_ - distance(load(readPos_), wpos));
+		std::size_t const i = index(wpos), first = std::min(num, size_ - i);
+		Spans const spans = { buf_ + i, first, buf_, num - first };
+		return spans;
+	}
+
+	// Producer side. Publishes num items written to the spans from reserve.
+	void commit(std::size_t num) {
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&writePos_, advance(load(writePos_), num));
+	}
+
+	// Producer side, before the consumer starts. Fills num items of the ring
+	// with value, as if written.
+	void fill(T const &value, std::size_t num) {
+		std::fill(buf_.get(), buf_.get() + size_, value);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&writePos_, advance(load(readPos_), std::min(num, size_)));
+	}
+
+	// Consumer side. Reads up to num items, returning how many were read.
+	std::size_t read(T *out, std::size_t num) {
+		std::size_t const rpos = load(readPos_);
+		num = std::min(num, distance(rpos, load(writePos_)));
+		SDL_MemoryBarrierAcquire();
+		std::size_t const i = index(rpos), first = std::min(num, size_ - i);
+		std::memcpy(out, buf_ + i, first * sizeof *out);
+		std::memcpy(out + first, buf_, (num - first) * sizeof *out);
+		SDL_MemoryBarrierRelease();
+		SDL_AtomicSet(&readPos_, advance(rpos, num));
+		return num;
+	}
+
+private:
+	enum { cache_line_size = 64 };
+
+	Array<T> const buf_;
+	std::size_t const size_;
+	char pad0_[cache_line_size];
+	mutable SDL_atomic_t readPos_;
+	char pad1_[cache_line_size - sizeof(SDL_atomic_t)];
+	mutable SDL_atomic_t writePos_;
+	char pad2_[cache_line_size - sizeof(SDL_atomic_t)];
+
+	static std::size_t load(SDL_atomic_t &pos) { return SDL_AtomicGet(&pos); }
+
+	std::size_t distance(std::size_t from, std::size_t to) const {
+		return to >= from ? to - from : to + 2 * size_ - from;
+	}
+
+	std::size_t advance(std::size_t pos, std::size_t num) const {
+		pos += num;
+		return pos >= 2 * size_ ? pos - 2 * size_ : pos;
+	}
+
+	std::size_t index(std::size_t pos) const { return pos >= size_ ? pos - size_ : pos; }
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "sramsaver.h"
+#include "safefile.h"
+#include "SDL_log.h"
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+
+namespace {
+
+std::string journalName(std::string const &filename, int const n) {
+	char num[12];
+	std::sprintf(num, ".%d", n);
+	return filename + num;
+}
+
+} // anon ns
+
+SramSaver::SramSaver(gambatte::GB &gb, std::string const &filename,
+                     int const interval, int const journal)
+: filename_(filename)
+, interval_(interval)
+, journal_(journal)
+, counter_(0)
+, pending_(gb.getSavedataLength())
+, scratch_(pending_.size())
+, written_(pending_.size())
+, mut_(SDL_CreateMutex())
+, cond_(SDL_CreateCond())
+, fresh_(false)
+, stop_(false)
+, thread_(0)
+{
+	// What was just loaded is already on disk
+	gb.saveSavedata(written_);
+	thread_ = SDL_CreateThread(workerThread, "sramsaver", this);
+}
+
+SramSaver::~SramSaver() {
+	if (thread_) {
+		{
+			LockGuard lock(mut_.get());
+			stop_ = true;
+			SDL_CondSignal(cond_.get());
+		}
+
+		SDL_WaitThread(thread_, 0);
+	}
+}
+
+void SramSaver::frame(gambatte::GB &gb) {
+	if (++counter_ < interval_)
+		return;
+
+	counter_ = 0;
+	snapshot(gb);
+}
+
+void SramSaver::snapshot(gambatte::GB &gb) {
+	LockGuard lock(mut_.get());
+	gb.saveSavedata(pending_);
+	fresh_ = true;
+	SDL_CondSignal(cond_.get());
+}
+
+int SramSaver::workerThread(void *const data) {
+	static_cast<SramSaver *>(data)->run();
+	return 0;
+}
+
+void SramSaver::run() {
+	LockGuard lock(mut_.get());
+
+	for (;;) {
+		if (fresh_) {
+			std::memcpy(scratch_, pending_, pending_.size());
+			fresh_ = false;
+
+			SDL_mutexV(mut_.get());
+			if (std::memcmp(scratch_, written_, scratch_.size()) != 0)
+				write();
+			SDL_mutexP(mut_.get());
+		} else if (stop_) {
+			return;
+		} else {
+			SDL_CondWait(cond_.get(), mut_.get());
+		}
+	}
+}
+
+void SramSaver::write() {
+	rotateJournal();
+
+	if (writeFileSafely(filename_, scratch_, scratch_.size()))
+		std::memcpy(written_, scratch_, scratch_.size());
+	else
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not write %s", filename_.c_str());
+}
+
+// Shifts the journal by one and links the current save file in as the
+// newest entry. Every step leaves complete files behind.
+void SramSaver::rotateJournal() {
+	if (journal_ <= 0 || access(filename_.c_str(), F_OK) != 0)
+		return;
+
+	for (int n = journal_ - 1; n > 0; --n)
+		std::rename(journalName(filename_, n).c_str(), journalName(filename_, n + 1).c_str());
+
+	std::string const newest = journalName(filename_, 1);
+	std::remove(newest.c_str());
+	if (link(filename_.c_str(), newest.c_str()) != 0)
+		SDL_LogWarn(SDL_LOG_CATEGORY_SYSTEM, "Could not keep %s", newest.c_str());
+}
@@ -0,0 +1,51 @@
+#ifndef SRAM_SAVER_H_
+#define SRAM_SAVER_H_
+
+#include "gambatte.h"
+#include "sdlutil.h"
+#include <common/array.h>
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <cstddef>
+#include <string>
+
+// Keeps the battery backed cartridge RAM on disk while the game runs, so
+// little is lost if the program is killed or the device loses power.
+//
+// The cartridge RAM is copied every interval frames. A worker thread writes
+// the copy if it differs from what was written last, through a temporary
+// file that is synced and renamed over the save file. With a journal, the
+// previous versions are kept as <file>.1 (newest) to <file>.<journal>.
+class SramSaver {
+public:
+	SramSaver(gambatte::GB &gb, std::string const &filename, int interval, int journal);
+	// Writes the last copy if it has not been written yet
+	~SramSaver();
+
+	// Call after every emulated frame
+	void frame(gambatte::GB &gb);
+	// Copies the cartridge RAM for the worker thread to write
+	void snapshot(gambatte::GB &gb);
+
+private:
+	std::string const filename_;
+	int const interval_;
+	int const journal_;
+	int counter_;
+	Array<char> const pending_;
+	Array<char> const scratch_;
+	Array<char> const written_;
+	scoped_ptr<SDL_mutex, SdlDeleter> const mut_;
+	scoped_ptr<SDL_cond, SdlDeleter> const cond_;
+	bool fresh_;
+	bool stop_;
+	SDL_Thread *thread_;
+
+	static int workerThread(void *data);
+	void run();
+	void write();
+	void rotateJournal();
+};
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef STATE_BUFFER_H_
+#define STATE_BUFFER_H_
+
+#include "gambatte.h"
+#include <common/array.h>
+#include <cstddef>
+#include <cstring>
+
+// Reusable in-memory save state. The state size is fixed for a loaded ROM,
+// so the buffer is sized on the first save and later saves reuse it without
+// allocating. Call reset() after loading another ROM.
+class StateBuffer {
+public:
+	StateBuffer() : size_(0), stateSize_(0) {}
+
+	bool save(gambatte::GB &gb) {
+		if (!stateSize_) {
+			// Passing no buffer only reports the size
+			stateSize_ = gb.saveState(0, 0, 0);
+			if (!stateSize_)
+				return false;
+		}
+
+		if (buf_.size() < stateSize_)
+			buf_.reset(stateSize_);
+
+		size_ = gb.saveState(0, 0, buf_);
+		return size_ != 0;
+	}
+
+	bool load(gambatte::GB &gb) const {
+		return size_ && gb.loadState(buf_, size_);
+	}
+
+	// Holds a copy of a state read from elsewhere
+	void assign(char const *data, std::size_t size) {
+		if (buf_.size() < size)
+			buf_.reset(size);
+
+		std::memcpy(buf_, data, size);
+		size_ = size;
+	}
+
+	char const * data() const { return buf_; }
+	std::size_t size() const { return size_; }
+	void reset() { buf_.reset(); size_ = stateSize_ = 0; }
+
+private:
+	Array<char> buf_;
+	std::size_t size_;
+	std::size_t stateSize_;
+};
+
+#endif
@@ -0,0 +1,234 @@
+#include "stateslots.h"
+#include "littleendian.h"
+#include "safefile.h"
+#include "SDL_log.h"
+#include <cstdio>
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+namespace {
+
+// Slot files are a magic number and the uncompressed size, both 4 bytes
+// little endian, followed by the zlib compressed state
+enum { header_size = 8 };
+unsigned long const state_magic = 0x31535347; // "GSS1"
+// Sanity limit for the size in the header, far above any real state
+unsigned long const max_state_size = 16 * 1024 * 1024;
+
+// Decompresses the state in a slot file. Returns false if it is damaged.
+bool decodeState(Array<char> const &file, Array<char> &state, std::size_t &size) {
+	unsigned char const *const in = reinterpret_cast<unsigned char const *>(file.get());
+	if (file.size() < header_size || get32(in) != state_magic
+			|| get32(in + 4) > max_state_size) {
+		return false;
+	}
+
+	uLongf packedSize = get32(in + 4);
+	state.reset(packedSize);
+	if (uncompress(reinterpret_cast<Bytef *>(state.get()), &packedSize,
+	               in + header_size, file.size() - header_size) != Z_OK) {
+		return false;
+	}
+
+	size = packedSize;
+	return true;
+}
+
+} // anon ns
+
+StateSlots::StateSlots(std::string const &romFilename)
+: basename_(romFilename + ".state")
+, snapshot_(&buffers_[NUM_SLOTS])
+, mut_(SDL_CreateMutex())
+, cond_(SDL_CreateCond())
+, pendingLoad_(-1)
+, stop_(false)
+, thread_(0)
+{
+	for (int i = 0; i < NUM_SLOTS; ++i) {
+		slots_[i].state = &buffers_[i];
+		slots_[i].inMemory = slots_[i].dirty = slots_[i].fetch = slots_[i].missing = false;
+	}
+
+	thread_ = SDL_CreateThread(workerThread, "stateslots", this);
+}
+
+StateSlots::~StateSlots() {
+	if (thread_) {
+		{
+			LockGuard lock(mut_.get());
+			stop_ = true;
+			SDL_CondSignal(cond_.get());
+		}
+
+		SDL_WaitThread(thread_, 0);
+	}
+}
+
+std::string StateSlots::filename(int const slot) const {
+	char num[4];
+	std::sprintf(num, "%d", slot);
+	return basename_ + num;
+}
+
+void StateSlots::save(gambatte::GB &gb, int const slot) {
+	if (!snapshot_->save(gb)) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not save state");
+		return;
+	}
+
+	// The slot's previous buffer becomes the spare. The worker only reads
+	// slot buffers under the lock, so it is not in use.
+	LockGuard lock(mut_.get());
+	Slot &s = slots_[slot];
+	std::swap(s.state, snapshot_);
+	s.inMemory = s.dirty = true;
+	s.missing = false;
+	SDL_CondSignal(cond_.get());
+	SDL_Log("Saved state to slot %d", slot);
+}
+
+bool StateSlots::loadNow(gambatte::GB &gb, int const slot) {
+	Slot const &s = slots_[slot];
+	if (s.missing) {
+		SDL_Log("State slot %d is empty", slot);
+		return true;
+	}
+
+	if (!s.inMemory)
+		return false;
+
+	if (s.state->load(gb))
+		SDL_Log("Loaded state from slot %d", slot);
+	else
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not load state from slot %d", slot);
+
+	return true;
+}
+
+void StateSlots::load(gambatte::GB &gb, int const slot) {
+	LockGuard lock(mut_.get());
+	pendingLoad_ = -1;
+	if (loadNow(gb, slot))
+		return;
+
+	pendingLoad_ = slot;
+	slots_[slot].fetch = true;
+	SDL_CondSignal(cond_.get());
+}
+
+void StateSlots::prefetch(int const slot) {
+	LockGuard lock(mut_.get());
+	Slot &s = slots_[slot];
+	if (!s.inMemory && !s.missing) {
+		s.fetch = true;
+		SDL_CondSignal(cond_.get());
+	}
+}
+
+void StateSlots::update(gambatte::GB &gb) {
+	if (pendingLoad_ < 0)
+		return;
+
+	LockGuard lock(mut_.get());
+	if (loadNow(gb, pendingLoad_))
+		pendingLoad_ = -1;
+}
+
+int StateSlots::workerThread(void *const data) {
+	static_cast<StateSlots *>(data)->run();
+	return 0;
+}
+
+void StateSlots::run() {
+	LockGuard lock(mut_.get());
+
+	for (;;) {
+		int writeSlot = -1, readSlot = -1;
+		for (int i = 0; i < NUM_SLOTS; ++i) {
+			if (slots_[i].dirty && writeSlot < 0)
+				writeSlot = i;
+			if (slots_[i].fetch && readSlot < 0)
+				readSlot = i;
+		}
+
+		if (writeSlot >= 0) {
+			// Saving again while this one is written marks the slot dirty again
+			Slot &s = slots_[writeSlot];
+			std::size_t const size = s.state->size();
+			if (scratch_.size() < size)
+				scratch_.reset(size);
+
+			std::memcpy(scratch_, s.state->data(), size);
+			s.dirty = false;
+
+			SDL_mutexV(mut_.get());
+			write(writeSlot, size);
+			SDL_mutexP(mut_.get());
+		} else if (readSlot >= 0) {
+			slots_[readSlot].fetch = false;
+			if (slots_[readSlot].inMemory)
+				continue;
+
+			SDL_mutexV(mut_.get());
+			read(readSlot);
+			SDL_mutexP(mut_.get());
+		} else if (stop_) {
+			return;
+		} else {
+			SDL_CondWait(cond_.get(), mut_.get());
+		}
+	}
+}
+
+void StateSlots::write(int const slot, std::size_t const size) {
+	uLongf packedSize = compressBound(size);
+	Array<unsigned char> const out(header_size + packedSize);
+	put32(out, state_magic);
+	put32(out + 4, size);
+
+	if (compress(out + header_size, &packedSize,
+	             reinterpret_cast<Bytef const *>(scratch_.get()), size) != Z_OK
+			|| !writeFileSafely(filename(slot), out, header_size + packedSize)) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Could not write state slot %d", slot);
+	}
+}
+
+bool StateSlots::loadFile(gambatte::GB &gb, std::string const &filename) {
+	Array<char> file, state;
+	std::size_t size = 0;
+	if (!readFile(filename, file)) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot read %s", filename.c_str());
+		return false;
+	}
+
+	if (!decodeState(file, state, size) || !gb.loadState(state, size)) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "%s is not a usable state", filename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+void StateSlots::read(int const slot) {
+	Array<char> file, state;
+	std::size_t size = 0;
+	bool const exists = readFile(filename(slot), file);
+	bool const ok = exists && decodeState(file, state, size);
+
+	LockGuard lock(mut_.get());
+	Slot &s = slots_[slot];
+	if (s.inMemory)
+		return;
+
+	if (ok) {
+		s.state->assign(state, size);
+		s.inMemory = true;
+	} else {
+		if (exists)
+			SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "State slot %d is damaged", slot);
+
+		s.missing = true;
+	}
+}
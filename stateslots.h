@@ -0,0 +1,72 @@
+#ifndef STATE_SLOTS_H_
+#define STATE_SLOTS_H_
+
+#include "gambatte.h"
+#include "sdlutil.h"
+#include "statebuffer.h"
+#include <common/array.h>
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <SDL_thread.h>
+#include <cstddef>
+#include <string>
+
+// Numbered save state slots, stored next to the ROM as <rom>.state<n>.
+//
+// Saving only takes a state in memory; a worker thread compresses it and
+// writes it out durably, so the calling (emulation) thread never waits for
+// the disk. Slots are read and decompressed by the same thread, either when
+// prefetched or when loaded for the first time. Loading a slot that is in
+// memory, or was just saved, is immediate.
+class StateSlots {
+public:
+	enum { NUM_SLOTS = 10 };
+
+	explicit StateSlots(std::string const &romFilename);
+	// Finishes pending writes
+	~StateSlots();
+
+	void save(gambatte::GB &gb, int slot);
+	// Loads the slot now if it is in memory, otherwise as soon as it has been
+	// read by a later call to update.
+	void load(gambatte::GB &gb, int slot);
+	// Reads the slot into memory in the background if it is not there yet.
+	void prefetch(int slot);
+	// Completes a pending load. Call regularly, between runFor calls.
+	void update(gambatte::GB &gb);
+
+	// Loads a state from a slot file right away. Returns false if the file
+	// cannot be read or loaded.
+	static bool loadFile(gambatte::GB &gb, std::string const &filename);
+
+private:
+	struct Slot {
+		StateBuffer *state; // one of buffers_
+		bool inMemory; // state holds the latest contents of the slot
+		bool dirty;    // state needs to be written
+		bool fetch;    // the file needs to be read
+		bool missing;  // there is no readable file
+	};
+
+	std::string const basename_;
+	Slot slots_[NUM_SLOTS];
+	// A buffer for each slot and a spare one. Saving fills the spare
+	// without holding the lock and then swaps it with the slot's.
+	StateBuffer buffers_[NUM_SLOTS + 1];
+	StateBuffer *snapshot_;
+	Array<char> scratch_;
+	scoped_ptr<SDL_mutex, SdlDeleter> const mut_;
+	scoped_ptr<SDL_cond, SdlDeleter> const cond_;
+	int pendingLoad_;
+	bool stop_;
+	SDL_Thread *thread_;
+
+	std::string filename(int slot) const;
+	bool loadNow(gambatte::GB &gb, int slot);
+	static int workerThread(void *data);
+	void run();
+	void write(int slot, std::size_t size);
+	void read(int slot);
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "telemetry.h"
+#include "SDL_log.h"
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+static telemetry_header *header;
+static telemetry_record *records;
+static size_t mapping_size;
+static int shm_active = 0;
+static const char *csv_output;
+
+int telemetry_active() { return header != NULL; }
+
+// Records one loop iteration. Lock-free and allocation-free; safe to call from
+// a single thread at a time.
+void telemetry_push(const telemetry_record *rec) {
+  if (header == NULL)
+    return;
+
+  int const n = SDL_AtomicGet(&header->count);
+  telemetry_record *slot = &records[n & (TELEMETRY_RECORDS - 1)];
+
+  SDL_AtomicSet(&slot->seq, 0);
+  slot->runfor_usecs = rec->runfor_usecs;
+  slot->samples = rec->samples;
+  slot->audio_rate = rec->audio_rate;
+  slot->audio_block_usecs = rec->audio_block_usecs;
+  slot->frame_wait_late_usecs = rec->frame_wait_late_usecs;
+  slot->present_usecs = rec->present_usecs;
+  slot->run_ahead_usecs = rec->run_ahead_usecs;
+  slot->flags = rec->flags;
+  SDL_MemoryBarrierRelease();
+  SDL_AtomicSet(&slot->seq, n + 1);
+  SDL_AtomicSet(&header->count, n + 1);
+}
+
+// Writes the records still in the ring to the CSV file
+static void write_csv() {
+  FILE *f = fopen(csv_output, "w");
+  if (f == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot open telemetry file %s",
+                 csv_output);
+    return;
+  }
+
+  fprintf(f, "record,runfor_usecs,samples,frame_done,skipped,audio_rate,"
+             "audio_low,audio_block_usecs,frame_wait_late_usecs,"
+             "present_usecs,run_ahead_usecs\n");
+
+  unsigned const count = SDL_AtomicGet(&header->count);
+  unsigned const first = count > TELEMETRY_RECORDS ? count - TELEMETRY_RECORDS : 0;
+  for (unsigned n = first; n < count; n++) {
+    const telemetry_record *rec = &records[n & (TELEMETRY_RECORDS - 1)];
+    fprintf(f, "%u,%u,%u,%d,%d,%d,%d,%u,%u,%u,%u\n", n, rec->runfor_usecs,
+            rec->samples, (rec->flags & TELEMETRY_FRAME_DONE) != 0,
+            (rec->flags & TELEMETRY_SKIPPED) != 0, rec->audio_rate,
+            (rec->flags & TELEMETRY_AUDIO_LOW) != 0, rec->audio_block_usecs,
+            rec->frame_wait_late_usecs, rec->present_usecs,
+            rec->run_ahead_usecs);
+  }
+
+  fclose(f);
+  SDL_Log("Wrote %u telemetry records to %s", count - first, csv_output);
+}
+
+static void telemetry_destroy() {
+  if (header == NULL)
+    return;
+
+  write_csv();
+
+  if (shm_active) {
+    munmap(header, mapping_size);
+    shm_unlink(TELEMETRY_SHM_NAME);
+    shm_active = 0;
+  } else {
+    free(header);
+  }
+  header = NULL;
+  records = NULL;
+}
+
+// Allocates the telemetry ring, exported as POSIX shared memory when possible.
+// The ring is written to csv_filename on exit.
+int telemetry_setup(const char *csv_filename) {
+  mapping_size =
+      sizeof(telemetry_header) + TELEMETRY_RECORDS * sizeof(telemetry_record);
+  csv_output = csv_filename;
+
+  SDL_Log("Initializing telemetry");
+
+  int fd = shm_open(TELEMETRY_SHM_NAME, O_CREAT | O_RDWR | O_TRUNC, 0644);
+  if (fd >= 0 && ftruncate(fd, mapping_size) == 0) {
+    void *mem = mmap(NULL, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd, 0);
+    if (mem != MAP_FAILED) {
+      header = static_cast<telemetry_header *>(mem);
+      shm_active = 1;
+      SDL_Log("Telemetry exported as shared memory %s", TELEMETRY_SHM_NAME);
+    }
+  }
+  if (fd >= 0)
+    close(fd);
+
+  if (header == NULL) {
+    SDL_LogError(SDL_LOG_CATEGORY_SYSTEM,
+                 "Cannot create telemetry shared memory, keeping it private");
+    header = static_cast<telemetry_header *>(calloc(1, mapping_size));
+    if (header == NULL)
+      return -1;
+  }
+
+  // Touch every page up front so the hot path never faults them in
+  memset(header, 0, mapping_size);
+  records = reinterpret_cast<telemetry_record *>(header + 1);
+  header->version = TELEMETRY_VERSION;
+  header->record_size = sizeof(telemetry_record);
+  header->capacity = TELEMETRY_RECORDS;
+  SDL_AtomicSet(&header->count, 0);
+  SDL_MemoryBarrierRelease();
+  header->magic = TELEMETRY_MAGIC;
+
+  atexit(telemetry_destroy);
+  return 0;
+}
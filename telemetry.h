@@ -0,0 +1,46 @@
+#ifndef TELEMETRY_H_
+#define TELEMETRY_H_
+
+#include <SDL.h>
+#include <stdint.h>
+
+#define TELEMETRY_SHM_NAME "/gambatte-sdl2-telemetry"
+#define TELEMETRY_MAGIC 0x67627431 // "gbt1"
+#define TELEMETRY_VERSION 2
+#define TELEMETRY_RECORDS 8192 // must be a power of two
+
+// telemetry_record.flags
+#define TELEMETRY_FRAME_DONE 1 // runFor completed a video frame
+#define TELEMETRY_SKIPPED 2    // the completed frame was not shown
+#define TELEMETRY_AUDIO_LOW 4  // AudioOut reported a low buffer
+
+// Timings of one main loop iteration
+typedef struct telemetry_record {
+  SDL_atomic_t seq; // record number + 1, 0 while the record is being written
+  uint32_t runfor_usecs;
+  uint32_t samples;        // samples handed to audio output
+  int32_t audio_rate;      // estimated audio output rate
+  uint32_t audio_block_usecs; // time AudioSink::write waited for room
+  uint32_t frame_wait_late_usecs; // how late FrameWait woke up
+  uint32_t present_usecs;
+  uint32_t run_ahead_usecs; // time spent running ahead and rolling back
+  uint32_t flags;
+} telemetry_record;
+
+// Layout of the shared memory segment. A reader takes count, then reads
+// records backwards from (count - 1) % capacity. A record is valid if its
+// seq is the same non-zero value before and after copying it out.
+typedef struct telemetry_header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t capacity;
+  SDL_atomic_t count; // number of records written so far
+  uint32_t reserved[11];
+} telemetry_header;
+
+int telemetry_setup(const char *csv_filename);
+int telemetry_active();
+void telemetry_push(const telemetry_record *rec);
+
+#endif
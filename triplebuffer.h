@@ -0,0 +1,55 @@
+#ifndef TRIPLE_BUFFER_H_
+#define TRIPLE_BUFFER_H_
+
+#include <common/array.h>
+#include <SDL.h>
+#include <cstddef>
+
+// Lock-free single producer, single consumer triple buffer. The producer
+// always has a back buffer to write into and the consumer always sees the
+// most recently published buffer, so neither side ever waits for the other.
+// Unconsumed buffers are dropped in favour of newer ones.
+template<typename T>
+class TripleBuffer {
+public:
+	explicit TripleBuffer(std::size_t size)
+	: buf_(size * 3), size_(size), back_(0), front_(1)
+	{
+		SDL_AtomicSet(&middle_, 2);
+	}
+
+	std::size_t size() const { return size_; }
+
+	// Producer side. The back buffer may be written freely until publish().
+	T * back() const { return buf_ + back_ * size_; }
+
+	void publish() {
+		SDL_MemoryBarrierRelease();
+		back_ = SDL_AtomicSet(&middle_, back_ | fresh) & index_mask;
+	}
+
+	// Consumer side. Makes the most recently published buffer the front
+	// buffer, returning false if nothing was published since the last call.
+	bool update() {
+		if (!(SDL_AtomicGet(&middle_) & fresh))
+			return false;
+
+		SDL_MemoryBarrierRelease();
+		front_ = SDL_AtomicSet(&middle_, front_) & index_mask;
+		SDL_MemoryBarrierAcquire();
+		return true;
+	}
+
+	T const * front() const { return buf_ + front_ * size_; }
+
+private:
+	enum { index_mask = 3, fresh = 4 };
+
+	Array<T> const buf_;
+	std::size_t const size_;
+	int back_;
+	int front_;
+	SDL_atomic_t middle_;
+};
+
+#endif
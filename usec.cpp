@@ -20,7 +20,9 @@
 #include <SDL.h>
 
 usec_t getusecs() {
-	return SDL_GetTicks() * usec_t(1000);
+	static Uint64 const freq = SDL_GetPerformanceFrequency();
+	Uint64 const now = SDL_GetPerformanceCounter();
+	return usec_t(now / freq * 1000000 + now % freq * 1000000 / freq);
 }
 
 void usecsleep(usec_t usecs) {
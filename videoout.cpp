@@ -0,0 +1,190 @@
+#include "videoout.h"
+#include "SDL_log.h"
+#include "rgb565.h"
+#include <algorithm>
+
+// Unchanged frames are still presented this often, so that the window
+// recovers if its contents get lost.
+static int const max_unchanged_frames = 60;
+
+VideoOut::VideoOut(SDL_Renderer *const renderer, int const width, int const height,
+                   unsigned const flags, int const scale, Scaler::Filter const filter)
+: rend_(renderer)
+, scaler_(scale > 1 ? new Scaler(width, height, scale, filter) : 0)
+, width_(width)
+, height_(height)
+, textureWidth_(scaler_.get() ? width * scaler_->factor() : width)
+, textureHeight_(scaler_.get() ? height * scaler_->factor() : height)
+, rgb565_((flags & RGB565) && !scaler_.get())
+, texture_(SDL_CreateTexture(renderer,
+                             rgb565_ ? SDL_PIXELFORMAT_RGB565 : SDL_PIXELFORMAT_RGB888,
+                             SDL_TEXTUREACCESS_STREAMING, textureWidth_, textureHeight_))
+, direct_((flags & DIRECT) && !(flags & SKIP_UNCHANGED) && !scaler_.get() && !rgb565_)
+, diff_(flags & SKIP_UNCHANGED ? new FrameDiff(width, height) : 0)
+, frameBuf_(0)
+, pitch_(width)
+, locked_(false)
+, changed_(true)
+, unchangedFrames_(0)
+{
+	if (!texture_)
+		SDL_LogError(SDL_LOG_CATEGORY_RENDER, "Could not create texture: %s", SDL_GetError());
+
+	if (scaler_.get()) {
+		SDL_Log("Scaling frames %dx using %s filter", scaler_->factor(),
+		        Scaler::filterName(filter));
+		// The scaled texture is copied 1:1, see present()
+		SDL_RenderSetLogicalSize(rend_, 0, 0);
+
+		if (flags & RGB565)
+			SDL_Log("RGB565 output is not supported with the built-in scaler");
+	}
+
+	if (rgb565_)
+		SDL_Log("Using RGB565 output");
+
+	// Sets up frameBuf, falling back to a system memory buffer
+	lock();
+}
+
+VideoOut::~VideoOut() {
+	if (locked_)
+		SDL_UnlockTexture(texture_);
+
+	SDL_DestroyTexture(texture_);
+}
+
+void VideoOut::lock() {
+	void *pixels = 0;
+	int pitch = 0;
+	if (direct_ && texture_ && SDL_LockTexture(texture_, 0, &pixels, &pitch) == 0) {
+		if (pitch % sizeof *frameBuf_ == 0) {
+			frameBuf_ = static_cast<gambatte::uint_least32_t *>(pixels);
+			pitch_ = pitch / sizeof *frameBuf_;
+			locked_ = true;
+			return;
+		}
+
+		SDL_UnlockTexture(texture_);
+	}
+
+	if (!fallbackBuf_) {
+		if (direct_)
+			SDL_Log("Texture can not be rendered into directly, using a frame buffer");
+
+		fallbackBuf_.reset(std::size_t(width_) * height_);
+		std::fill(fallbackBuf_.get(), fallbackBuf_.get() + fallbackBuf_.size(), 0);
+	}
+
+	frameBuf_ = fallbackBuf_;
+	pitch_ = width_;
+	locked_ = false;
+}
+
+void VideoOut::upload() {
+	upload(frameBuf_, pitch_);
+}
+
+void VideoOut::upload(gambatte::uint_least32_t const *const frame, std::ptrdiff_t const pitch) {
+	unsigned long const dirtyBands = diff_.get() ? diff_->update(frame, pitch) : ~0ul;
+	changed_ = dirtyBands || ++unchangedFrames_ >= max_unchanged_frames;
+	if (!changed_)
+		return;
+
+	unchangedFrames_ = 0;
+
+	// Unlocking uploads the whole texture, which already holds the frame
+	if (locked_) {
+		SDL_UnlockTexture(texture_);
+		locked_ = false;
+		return;
+	}
+
+	if (!texture_)
+		return;
+
+	if (scaler_.get()) {
+		void *pixels = 0;
+		int texturePitch = 0;
+		if (SDL_LockTexture(texture_, 0, &pixels, &texturePitch) == 0) {
+			scaler_->scale(static_cast<gambatte::uint_least32_t *>(pixels),
+			               texturePitch / sizeof *frame, frame, pitch);
+			SDL_UnlockTexture(texture_);
+		}
+	} else {
+		updateTexture(frame, pitch, dirtyBands ? dirtyBands : ~0ul);
+	}
+}
+
+// Uploads the changed bands, merging adjacent ones into a single rect.
+void VideoOut::updateTexture(gambatte::uint_least32_t const *const frame,
+                             std::ptrdiff_t const pitch, unsigned long const dirtyBands)
+{
+	int const bands = diff_.get() ? diff_->bands() : 1;
+	int const bandRows = diff_.get() ? int(FrameDiff::band_rows) : height_;
+
+	for (int band = 0; band < bands;) {
+		if (!(dirtyBands >> band & 1)) {
+			++band;
+			continue;
+		}
+
+		int end = band + 1;
+		while (end < bands && (dirtyBands >> end & 1))
+			++end;
+
+		int const y = band * bandRows;
+		updateRows(frame, pitch, y, std::min(end * bandRows, height_) - y);
+		band = end;
+	}
+}
+
+void VideoOut::updateRows(gambatte::uint_least32_t const *const frame,
+                          std::ptrdiff_t const pitch, int const y, int const rows)
+{
+	SDL_Rect const rect = { 0, y, width_, rows };
+	if (!rgb565_) {
+		SDL_UpdateTexture(texture_, &rect, frame + y * pitch, pitch * sizeof *frame);
+		return;
+	}
+
+	// Convert straight into the locked rows, so the 16 bit frame is the only
+	// thing written to texture memory
+	void *pixels = 0;
+	int texturePitch = 0;
+	if (SDL_LockTexture(texture_, &rect, &pixels, &texturePitch) != 0)
+		return;
+
+	for (int row = 0; row < rows; ++row) {
+		convert_rgb565(reinterpret_cast<Uint16 *>(static_cast<Uint8 *>(pixels) + row * texturePitch),
+		               frame + (y + row) * pitch, width_);
+	}
+
+	SDL_UnlockTexture(texture_);
+}
+
+bool VideoOut::present() {
+	if (!changed_)
+		return false;
+
+	SDL_SetRenderTarget(rend_, 0);
+	SDL_SetRenderDrawColor(rend_, 0, 0, 0, 0);
+	SDL_RenderClear(rend_);
+
+	if (scaler_.get()) {
+		int outWidth = textureWidth_, outHeight = textureHeight_;
+		SDL_GetRendererOutputSize(rend_, &outWidth, &outHeight);
+		SDL_Rect const dst = { (outWidth - textureWidth_) / 2, (outHeight - textureHeight_) / 2,
+		                       textureWidth_, textureHeight_ };
+		SDL_RenderCopy(rend_, texture_, 0, &dst);
+	} else {
+		SDL_RenderCopy(rend_, texture_, 0, 0);
+	}
+
+	SDL_RenderPresent(rend_);
+
+	if (direct_ && !locked_)
+		lock();
+
+	return true;
+}
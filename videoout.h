@@ -0,0 +1,81 @@
+#ifndef VIDEO_OUT_H_
+#define VIDEO_OUT_H_
+
+#include "framediff.h"
+#include "gbint.h"
+#include "scaler.h"
+#include "videosink.h"
+#include <common/array.h>
+#include <common/scoped_ptr.h>
+#include <SDL.h>
+#include <cstddef>
+
+// Owns the streaming texture frames are shown through.
+//
+// With the DIRECT flag the texture stays locked while the emulator runs
+// whenever possible, so gb.runFor renders straight into texture memory and
+// no intermediate frame copy is made. If the texture cannot be locked (or SDL
+// hands out an unusable pitch), frames are rendered into a system memory
+// buffer and uploaded with SDL_UpdateTexture instead. Without it, frames
+// rendered elsewhere are handed over through upload(frame, pitch).
+//
+// With SKIP_UNCHANGED, frames identical to the previous one are neither
+// uploaded nor presented, and changed frames only upload the rows that
+// changed. Comparing frames reads them back, which locked texture memory is
+// not meant for (it may be write-combined or a fresh buffer on every lock),
+// so the two flags do not combine: DIRECT is ignored and frames are rendered
+// into the system memory buffer.
+//
+// With RGB565 the texture is 16 bits per pixel and frames are converted as
+// they are uploaded, halving the bytes pushed per frame.
+//
+// With a scale factor above 1, frames are scaled by Scaler into a display
+// sized texture that is then copied to the screen 1:1, so a software
+// renderer does not have to scale.
+class VideoOut : public VideoSink {
+public:
+	enum Flag {
+		DIRECT = 1,
+		SKIP_UNCHANGED = 2,
+		RGB565 = 4
+	};
+
+	VideoOut(SDL_Renderer *renderer, int width, int height, unsigned flags,
+	         int scale = 1, Scaler::Filter filter = Scaler::NEAREST);
+	virtual ~VideoOut();
+
+	virtual gambatte::uint_least32_t * frameBuf() const { return frameBuf_; }
+	virtual std::ptrdiff_t pitch() const { return pitch_; }
+	virtual void upload();
+	virtual void upload(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch);
+
+	// Presents the uploaded frame and readies a buffer for the next one.
+	// Does nothing and returns false if the uploaded frame was unchanged.
+	virtual bool present();
+
+private:
+	SDL_Renderer *const rend_;
+	scoped_ptr<Scaler> const scaler_;
+	int const width_;
+	int const height_;
+	int const textureWidth_;
+	int const textureHeight_;
+	bool const rgb565_;
+	SDL_Texture *const texture_;
+	bool const direct_;
+	scoped_ptr<FrameDiff> const diff_;
+	Array<gambatte::uint_least32_t> fallbackBuf_;
+	gambatte::uint_least32_t *frameBuf_;
+	std::ptrdiff_t pitch_;
+	bool locked_;
+	bool changed_;
+	int unchangedFrames_;
+
+	void lock();
+	void updateTexture(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch,
+	                   unsigned long dirtyBands);
+	void updateRows(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch,
+	                int y, int rows);
+};
+
+#endif
@@ -0,0 +1,52 @@
+#ifndef VIDEO_SINK_H_
+#define VIDEO_SINK_H_
+
+#include "gbint.h"
+#include <common/array.h>
+#include <algorithm>
+#include <cstddef>
+
+// Destination for emulated frames. The emulator renders into frameBuf();
+// upload() hands a finished frame over, and present() shows it once the
+// frame's time has come.
+class VideoSink {
+public:
+	virtual ~VideoSink() {}
+
+	// Buffer the next frame should be rendered into, and its pitch in pixels.
+	// Only valid until the next call to upload() or present().
+	virtual gambatte::uint_least32_t * frameBuf() const = 0;
+	virtual std::ptrdiff_t pitch() const = 0;
+
+	// Hands the finished frame in frameBuf() over.
+	virtual void upload() = 0;
+
+	// Hands over a frame rendered into some other buffer, pitch in pixels.
+	virtual void upload(gambatte::uint_least32_t const *frame, std::ptrdiff_t pitch) = 0;
+
+	// Shows the uploaded frame. Returns false if nothing reached the screen,
+	// such as when the frame was unchanged and skipped.
+	virtual bool present() = 0;
+};
+
+// Discards all frames.
+class NullVideoSink : public VideoSink {
+public:
+	NullVideoSink(int width, int height)
+	: buf_(std::size_t(width) * height), width_(width)
+	{
+		std::fill(buf_.get(), buf_.get() + buf_.size(), 0);
+	}
+
+	virtual gambatte::uint_least32_t * frameBuf() const { return buf_; }
+	virtual std::ptrdiff_t pitch() const { return width_; }
+	virtual void upload() {}
+	virtual void upload(gambatte::uint_least32_t const *, std::ptrdiff_t) {}
+	virtual bool present() { return false; }
+
+private:
+	Array<gambatte::uint_least32_t> const buf_;
+	int const width_;
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include "wavwriter.h"
+#include "littleendian.h"
+#include "SDL_log.h"
+
+namespace {
+
+enum { buffer_size = 1 << 16 };
+enum { header_size = 44 };
+
+static void writeHeader(std::FILE *file, long sampleRate, int channels,
+                        unsigned long dataBytes)
+{
+	unsigned char h[header_size] = {
+		'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E',
+		'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 0, 0,
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 0,
+		'd', 'a', 't', 'a', 0, 0, 0, 0
+	};
+	put32(h + 4, dataBytes + header_size - 8);
+	put16(h + 22, channels);
+	put32(h + 24, sampleRate);
+	put32(h + 28, sampleRate * channels * 2);
+	put16(h + 32, channels * 2);
+	put32(h + 40, dataBytes);
+	std::fwrite(h, 1, sizeof h, file);
+}
+
+} // anon ns
+
+WavWriter::WavWriter()
+: file_(0), sampleRate_(0), channels_(2), dataBytes_(0)
+{
+}
+
+WavWriter::~WavWriter() {
+	close();
+}
+
+bool WavWriter::open(char const *filename, long sampleRate, int channels) {
+	close();
+
+	file_ = std::fopen(filename, "wb");
+	if (!file_) {
+		SDL_LogError(SDL_LOG_CATEGORY_SYSTEM, "Cannot open %s for writing", filename);
+		return false;
+	}
+
+	if (!buf_)
+		buf_.reset(buffer_size);
+
+	std::setvbuf(file_, buf_, _IOFBF, buf_.size());
+	sampleRate_ = sampleRate;
+	channels_ = channels;
+	dataBytes_ = 0;
+	writeHeader(file_, sampleRate, channels, 0);
+	return true;
+}
+
+void WavWriter::write(Sint16 const *samples, std::size_t frames) {
+	if (!file_)
+		return;
+
+#if SDL_BYTEORDER == SDL_BIG_ENDIAN
+	for (std::size_t i = 0; i < frames * channels_; ++i) {
+		unsigned char le[2];
+		put16(le, Uint16(samples[i]));
+		std::fwrite(le, 1, 2, file_);
+	}
+#else
+	std::fwrite(samples, 2 * channels_, frames, file_);
+#endif
+	dataBytes_ += frames * channels_ * 2;
+}
+
+void WavWriter::close() {
+	if (!file_)
+		return;
+
+	// Go back and fill in the sizes now that they are known
+	if (std::fseek(file_, 0, SEEK_SET) == 0)
+		writeHeader(file_, sampleRate_, channels_, dataBytes_);
+
+	std::fclose(file_);
+	file_ = 0;
+}
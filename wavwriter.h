@@ -0,0 +1,35 @@
+#ifndef WAV_WRITER_H_
+#define WAV_WRITER_H_
+
+#include <common/array.h>
+#include <SDL.h>
+#include <cstddef>
+#include <cstdio>
+
+// Writes interleaved 16 bit PCM to a WAV file through a fixed size buffer,
+// so writing never allocates. The header is completed by close().
+class WavWriter {
+public:
+	WavWriter();
+	~WavWriter();
+
+	bool open(char const *filename, long sampleRate, int channels);
+	bool isOpen() const { return file_ != 0; }
+
+	// Writes frames (one sample per channel each) of interleaved samples.
+	void write(Sint16 const *samples, std::size_t frames);
+
+	void close();
+
+private:
+	std::FILE *file_;
+	Array<char> buf_;
+	long sampleRate_;
+	int channels_;
+	unsigned long dataBytes_;
+
+	WavWriter(WavWriter const &);
+	WavWriter & operator=(WavWriter const &);
+};
+
+#endif